@@ -47,6 +47,11 @@ extern const char *VERSION;
 /* how long to keep-alive client connection since it was last used */
 #define KEEP_ALIVE_MS 5000
 
+/* messages of a processor to the exec thread on the channel, besides the
+   stop flags of each served connection (see exec_pass) */
+#define PROC_READY 0x10
+#define PROC_REPLY 0x20
+
 typedef struct {
     List *head;
     List *tail;
@@ -56,8 +61,10 @@ typedef struct {
 typedef struct {
     char exe[MAX_FILE_PATH];
     char tx[MAX_ADDR];
+    char data[MAX_FILE_PATH]; /* local volume directory (if any) */
     Queue *runq;
     Queue *waitq;
+    Poll *poll; /* woken up on waitq_put */
 } Exec;
 
 typedef struct {
@@ -126,84 +133,199 @@ static Conn *queue_get(Queue *q)
     return conn;
 }
 
-static void queue_wait(Queue *q, int ms)
+static Conn *queue_try(Queue *q)
 {
+    Conn *conn = NULL;
+
     mon_lock(q->mon);
-    mon_wait(q->mon, ms);
+    if (q->tail != NULL) {
+        conn = q->tail->elem;
+        q->tail = list_prev(q->tail);
+        if (q->tail == NULL)
+            q->head = NULL;
+    }
     mon_unlock(q->mon);
+
+    return conn;
 }
 
+static void waitq_put(Exec *e, Conn *c)
+{
+    queue_put(e->waitq, c);
+    poll_wake(e->poll);
+}
+
+/* moves the idle connections to the runq as soon as they become readable.
+   the idle list is ordered by the last use (the oldest is the tail), so
+   the expiry only looks at its tail */
 static void *waitq_thread(void *arg)
 {
-    Conn *start = NULL;
     Exec *e = arg;
+    List *head = NULL, *tail = NULL;
+    void *ready[64];
+
     for (;;) {
-        Conn *c = queue_get(e->waitq);
-        if (c->io->stop) {
-            start = NULL;
-            conn_free(c);
-        } else if (sys_iready(c->io, 0)) {
-            start = NULL;
-            queue_put(e->runq, c);
-        } else if (sys_millis() - c->time > KEEP_ALIVE_MS) {
-            start = NULL;
+        Conn *c;
+        while ((c = queue_try(e->waitq)) != NULL)
+            if (c->io->stop) {
+                /* it stays watched (disarmed) since it was last ready */
+                poll_rm(e->poll, c->io);
+                conn_free(c);
+            } else {
+                head = list_prepend(head, c);
+                if (tail == NULL)
+                    tail = head;
+
+                poll_add(e->poll, c->io, head);
+            }
+
+        long long now = sys_millis();
+        while (tail != NULL &&
+               now - ((Conn*) tail->elem)->time > KEEP_ALIVE_MS)
+        {
+            c = tail->elem;
+            poll_rm(e->poll, c->io);
             conn_free(c);
-        } else {
-            if (start == c)                 /* we are in the wait-loop */
-                queue_wait(e->waitq, 10);   /* wait for new connections */
 
-            if (start == NULL)
-                start = c;
+            tail = list_prev(tail);
+            if (tail == NULL)
+                head = NULL;
+        }
+
+        int ms = -1;
+        if (tail != NULL)
+            ms = KEEP_ALIVE_MS - (now - ((Conn*) tail->elem)->time) + 1;
 
-            queue_put(e->waitq, c);
+        int len = poll_wait(e->poll, ready, 64, ms);
+        for (int i = 0; i < len; ++i) {
+            List *it = ready[i];
+            if (it == head)
+                head = it->next;
+            if (it == tail)
+                tail = it->prev;
+
+            queue_put(e->runq, it->elem);
+            list_del(it);
         }
     }
 
     return NULL;
 }
 
-static void *exec_thread(void *arg)
+/* forks a processor which talks to the client through the exec thread */
+static void exec_proxy(Exec *e)
 {
-    Exec *e = arg;
-    for (;;) {
-        int p = 0, pid = -1;
-
-        /* creating processor */
-        IO *sio = sys_socket(&p);
-        char port[8];
-        str_print(port, "%d", p);
-        char *argv[] = {e->exe, "processor", "-p", port, "-t", e->tx, NULL};
+    int p = 0, pid = -1;
+
+    IO *sio = sys_socket(&p);
+    char port[8];
+    str_print(port, "%d", p);
+    char *argv[] = {e->exe, "processor", "-p", port, "-t", e->tx,
+                    NULL, NULL, NULL};
+    if (str_cmp(e->data, "") != 0) {
+        argv[6] = "-d";
+        argv[7] = e->data;
+    }
 
-        pid = sys_exec(argv);
-        if (!sys_iready(sio, PROC_WAIT_SEC)) {
-            sys_log('E', "failed to fork a processor\n");
-        } else {
-            IO *pio = sys_accept(sio, IO_CHUNK);
-            int ok = 1;
-            while (ok) {
-                pio->stop = 0;
-                Conn *c = queue_get(e->runq);
-
-                int pcnt = 0, ccnt = 0;
-                sys_proxy(c->io, &ccnt, pio, &pcnt);
-
-                ok = pio->stop == IO_TERM || (ccnt == 0 && !pio->stop);
-                if (!ok && pcnt == 0) {
-                    int status = http_500(c->io);
-                    sys_log('E', "failed with status %d\n", status);
-                }
-
-                c->time = sys_millis();
-                queue_put(e->waitq, c);
+    pid = sys_exec(argv);
+    if (!sys_iready(sio, PROC_WAIT_SEC)) {
+        sys_log('E', "failed to fork a processor\n");
+    } else {
+        IO *pio = sys_accept(sio, IO_CHUNK);
+        int ok = 1;
+        while (ok) {
+            pio->stop = 0;
+            Conn *c = queue_get(e->runq);
+
+            int pcnt = 0, ccnt = 0;
+            sys_proxy(c->io, &ccnt, pio, &pcnt);
+
+            ok = pio->stop == IO_TERM || (ccnt == 0 && !pio->stop);
+            if (!ok && pcnt == 0) {
+                int status = http_500(c->io);
+                sys_log('E', "failed with status %d\n", status);
             }
-            sys_close(pio);
+
+            c->time = sys_millis();
+            waitq_put(e, c);
+        }
+        sys_close(pio);
+    }
+    sys_close(sio);
+
+    if (pid != -1) {
+        sys_kill(pid);
+        sys_wait(pid);
+    }
+}
+
+/* forks a processor and hands it the client connections over the channel.
+   the processor answers the client directly and replies with the stop
+   flags of the connection once the request is served. it also tells when
+   it is ready and when it starts to respond, a client only gets a 500 if
+   the processor failed before that. */
+static void exec_pass(Exec *e, IO *chan[2])
+{
+    char fd[8];
+    str_print(fd, "%d", chan[1]->fd);
+    char *argv[] = {e->exe, "processor", "-f", fd, "-t", e->tx,
+                    NULL, NULL, NULL};
+    if (str_cmp(e->data, "") != 0) {
+        argv[6] = "-d";
+        argv[7] = e->data;
+    }
+
+    int pid = sys_exec_io(argv, chan[1]);
+    sys_close(chan[1]);
+
+    char msg = 0;
+    int ok = sys_iready(chan[0], PROC_WAIT_SEC) &&
+             sys_readn(chan[0], &msg, 1) == 1 && msg == PROC_READY;
+    if (!ok) {
+        sys_log('E', "failed to fork a processor\n");
+
+        /* the same pace as a processor which never connects (exec_proxy) */
+        sys_sleep(PROC_WAIT_SEC);
+    }
+
+    while (ok) {
+        Conn *c = queue_get(e->runq);
+
+        char stop = IO_ERROR;
+        int replied = 0;
+        ok = sys_send_io(chan[0], c->io) > 0 &&
+             sys_readn(chan[0], &msg, 1) == 1;
+        if (ok && msg == PROC_REPLY) {
+            replied = 1;
+            ok = sys_readn(chan[0], &msg, 1) == 1;
         }
-        sys_close(sio);
 
-        if (pid != -1) {
-            sys_kill(pid);
-            sys_wait(pid);
+        if (ok)
+            stop = msg;
+        else if (!replied) {
+            int status = http_500(c->io);
+            sys_log('E', "failed with status %d\n", status);
         }
+
+        c->io->stop |= stop;
+        c->time = sys_millis();
+        waitq_put(e, c);
+    }
+    sys_close(chan[0]);
+
+    sys_kill(pid);
+    sys_wait(pid);
+}
+
+static void *exec_thread(void *arg)
+{
+    Exec *e = arg;
+    for (;;) {
+        IO *chan[2];
+        if (sys_chan(chan))
+            exec_pass(e, chan);
+        else
+            exec_proxy(e);
     }
 
     mem_free(e);
@@ -211,265 +333,339 @@ static void *exec_thread(void *arg)
     return NULL;
 }
 
-static void processor(const char *tx_addr, int port)
+/* tells the exec thread (if there is a channel) that the response starts,
+   from then on the exec thread must not answer the client itself */
+static void reply(IO *chan)
 {
-    sys_init(1);
-    sys_log('E', "started port=%d, tx=%s\n", port, tx_addr);
+    char msg = PROC_REPLY;
+    if (chan != NULL)
+        sys_write(chan, &msg, 1);
+}
 
-    /* connect to the control thread */
-    char addr[MAX_ADDR];
-    sys_address(addr, port);
-    IO *io = sys_connect(addr, IO_CHUNK);
+/* serves a single request, the response is written to the io. all the
+   tuples are allocated from the arena which is reset once the request is
+   over (the evaluated statements are reset by then as well) */
+static void serve(Env *env,
+                  const char *addr,
+                  IO *io,
+                  IO *chan,
+                  char *res,
+                  Arena *a)
+{
+    tuple_arena(a);
 
-    tx_attach(tx_addr);
+    int status = -1;
+    long long sid = 0LL, time = sys_millis();
 
-    /* get env code from the tx */
-    char *code = tx_program();
-    char *res = mem_alloc(MAX_BLOCK);
+    Arg *arg = NULL;
+    Vars *v = vars_new(0), *r = NULL, *w = NULL;
 
-    while (!io->stop) {
-        sys_iready(io, -1);
+    Http_Req *req = http_parse_req(io);
+    if (io->stop)
+        goto exit;
 
-        int status = -1;
-        long long sid = 0LL, time = sys_millis();
+    if (req == NULL) {
+        reply(chan);
+        status = http_400(io);
+        goto exit;
+    }
 
-        Env *env = NULL;
-        Arg *arg = NULL;
-        Vars *v = vars_new(0), *r = NULL, *w = NULL;
+    if (req->method == OPTIONS) {
+        reply(chan);
+        status = http_opts(io);
+        goto exit;
+    }
 
-        Http_Req *req = http_parse_req(io);
-        if (io->stop)
-            goto exit;
+    if (str_idx(req->path, "/fn") == 0) {
+        int idx = (req->path[3] == '/') ? 4 : 3;
+        int i = 0, len = 1, cnt = 0;
+        Func **fns = env_funcs(env, req->path + idx, &cnt);
 
-        if (req == NULL) {
-            status = http_400(io);
-            goto exit;
+        reply(chan);
+        status = http_200(io);
+        while (status == 200 && len) {
+            len = pack_fn2csv(fns, cnt, res, MAX_BLOCK, &i);
+            status = http_chunk(io, res, len);
         }
 
-        if (req->method == OPTIONS) {
-            status = http_opts(io);
-            goto exit;
-        }
+        mem_free(fns);
+        goto exit;
+    }
 
-        env = env_new("net", code);
+    /* compare the request with the function defintion */
+    Func *fn = env_func(env, req->path + 1);
+    if (fn == NULL) {
+        Error *err = error_new("unknown function '%s'", req->path + 1);
+        reply(chan);
+        status = http_404(io, err->msg);
+        mem_free(err);
+        goto exit;
+    }
 
-        if (str_idx(req->path, "/fn") == 0) {
-            int idx = (req->path[3] == '/') ? 4 : 3;
-            int i = 0, len = 1, cnt = 0;
-            Func **fns = env_funcs(env, req->path + idx, &cnt);
+    if (fn->rp.name != NULL && req->method != POST) {
+        reply(chan);
+        status = http_405(io, POST);
+        goto exit;
+    }
 
-            status = http_200(io);
-            while (status == 200 && len) {
-                len = pack_fn2csv(fns, cnt, res, MAX_BLOCK, &i);
-                status = http_chunk(io, res, len);
-            }
+    if (fn->rp.name == NULL && req->method == POST) {
+        reply(chan);
+        status = http_405(io, GET);
+        goto exit;
+    }
 
-            mem_free(fns);
+    /* TODO: think what to do with duplicate parameter values */
+    for (int i = 0; i < req->args->len; ++i) {
+        char *name = req->args->names[i];
+        if (array_freq(req->args->names, req->args->len, name) > 1) {
+            Error *err = error_new("duplicate parameter '%s' "
+                                   "(not supported)",
+                                   name);
+            reply(chan);
+            status = http_404(io, err->msg);
+            mem_free(err);
             goto exit;
         }
+    }
+
+    if (fn->pp.len != req->args->len) {
+        Error *err = error_new("expected %d primitive parameters, got %d",
+                               fn->pp.len, req->args->len);
+        reply(chan);
+        status = http_404(io, err->msg);
+        mem_free(err);
+        goto exit;
+    }
 
-        /* compare the request with the function defintion */
-        Func *fn = env_func(env, req->path + 1);
-        if (fn == NULL) {
-            Error *err = error_new("unknown function '%s'", req->path + 1);
+    arg = mem_alloc(sizeof(Arg));
+    for (int i = 0; i < fn->pp.len; ++i) {
+        char *name = fn->pp.names[i];
+        Type t = fn->pp.types[i];
+
+        int idx = array_scan(req->args->names, req->args->len, name);
+        if (idx < 0) {
+            Error *err = error_new("unknown parameter '%s'", name);
+            reply(chan);
             status = http_404(io, err->msg);
             mem_free(err);
             goto exit;
         }
 
-        if (fn->rp.name != NULL && req->method != POST) {
-            status = http_405(io, POST);
-            goto exit;
+        char *val = req->args->vals[idx];
+        int error = 0;
+        if (t == Int) {
+            arg->vals[i].v_int = str_int(val, &error);
+        } else if (t == Real)
+            arg->vals[i].v_real = str_real(val, &error);
+        else if (t == Long)
+            arg->vals[i].v_long = str_long(val, &error);
+        else if (t == String) {
+            error = str_len(val) > MAX_STRING;
+            if (!error)
+                str_cpy(arg->vals[i].v_str, val);
         }
 
-        if (fn->rp.name == NULL && req->method == POST) {
-            status = http_405(io, GET);
+        if (error) {
+            Error *err = error_new("value '%s' (parameter '%s') "
+                                   "is not of type '%s'",
+                                   val, name, type_to_str(t));
+            reply(chan);
+            status = http_404(io, err->msg);
+            mem_free(err);
             goto exit;
         }
+    }
 
-        /* TODO: think what to do with duplicate parameter values */
-        for (int i = 0; i < req->args->len; ++i) {
-            char *name = req->args->names[i];
-            if (array_freq(req->args->names, req->args->len, name) > 1) {
-                Error *err = error_new("duplicate parameter '%s' "
-                                       "(not supported)",
-                                       name);
+    if (fn->rp.name != NULL) {
+        TBuf *body = NULL;
+        if (req->len > 0) {
+            Error *err = pack_csv2rel(req->body, fn->rp.head, &body);
+            if (err != NULL) {
+                reply(chan);
                 status = http_404(io, err->msg);
                 mem_free(err);
                 goto exit;
             }
+        } else {
+            body = tbuf_new();
         }
 
-        if (fn->pp.len != req->args->len) {
-            Error *err = error_new("expected %d primitive parameters, got %d",
-                                   fn->pp.len, req->args->len);
-            status = http_404(io, err->msg);
-            mem_free(err);
-            goto exit;
-        }
+        vars_add(v, fn->rp.name, 0, body);
 
-        arg = mem_alloc(sizeof(Arg));
-        for (int i = 0; i < fn->pp.len; ++i) {
-            char *name = fn->pp.names[i];
-            Type t = fn->pp.types[i];
+        /* project the parameter */
+        Rel *param = rel_project(rel_load(fn->rp.head, fn->rp.name),
+                                 fn->rp.head->names,
+                                 fn->rp.head->len);
 
-            int idx = array_scan(req->args->names, req->args->len, name);
-            if (idx < 0) {
-                Error *err = error_new("unknown parameter '%s'", name);
-                status = http_404(io, err->msg);
-                mem_free(err);
-                goto exit;
-            }
+        rel_eval(param, v, arg);
 
-            char *val = req->args->vals[idx];
-            int error = 0;
-            if (t == Int) {
-                arg->vals[i].v_int = str_int(val, &error);
-            } else if (t == Real)
-                arg->vals[i].v_real = str_real(val, &error);
-            else if (t == Long)
-                arg->vals[i].v_long = str_long(val, &error);
-            else if (t == String) {
-                error = str_len(val) > MAX_STRING;
-                if (!error)
-                    str_cpy(arg->vals[i].v_str, val);
-            }
+        /* clean the previous version */
+        tbuf_clean(body);
+        tbuf_free(body);
 
-            if (error) {
-                Error *err = error_new("value '%s' (parameter '%s') "
-                                       "is not of type '%s'",
-                                       val, name, type_to_str(t));
-                status = http_404(io, err->msg);
-                mem_free(err);
-                goto exit;
-            }
-        }
+        /* replace with the new body */
+        int vpos = array_scan(v->names, v->len, fn->rp.name);
+        v->vals[vpos] = param->body;
 
-        if (fn->rp.name != NULL) {
-            TBuf *body = NULL;
-            if (req->len > 0) {
-                Error *err = pack_csv2rel(req->body, fn->rp.head, &body);
-                if (err != NULL) {
-                    status = http_404(io, err->msg);
-                    mem_free(err);
-                    goto exit;
-                }
-            } else {
-                body = tbuf_new();
-            }
+        param->body = NULL;
+        rel_free(param);
+    }
 
-            vars_add(v, fn->rp.name, 0, body);
+    /* start a transaction */
+    r = vars_new(fn->r.len);
+    w = vars_new(fn->w.len);
+    for (int i = 0; i < fn->r.len; ++i)
+        vars_add(r, fn->r.names[i], 0, NULL);
+    for (int i = 0; i < fn->w.len; ++i)
+        vars_add(w, fn->w.names[i], 0, NULL);
+
+    sid = tx_enter(addr, r, w);
+
+    /* prepare variables (they are read when first used, so the ones
+       searched through an index are never read as a whole) */
+    for (int i = 0; i < r->len; ++i) {
+        vars_add(v, r->names[i], r->vers[i], NULL);
+        str_cpy(v->vols[v->len - 1], r->vols[i]);
+        vars_stats(v, v->len - 1, r->stats[i]);
+    }
+    for (int i = 0; i < w->len; ++i) {
+        int pos = array_scan(v->names, v->len, w->names[i]);
+        if (pos < 0)
+            vars_add(v, w->names[i], 0, NULL);
+    }
+    for (int i = 0; i < fn->t.len; ++i)
+        vars_add(v, fn->t.names[i], 0, NULL);
+
+    /* evaluate the function body */
+    for (int i = 0; i < fn->slen; ++i)
+        rel_eval(fn->stmts[i], v, arg);
+
+    /* prepare the return value. note, the resulting relation
+       is just a container for the body, so it is not freed */
+    Rel *ret = NULL;
+    if (fn->ret != NULL)
+        ret = fn->stmts[fn->slen - 1];
+
+    /* persist the global variables */
+    for (int i = 0; i < w->len; ++i) {
+        int idx = array_scan(v->names, v->len, w->names[i]);
+        if (idx < 0) {
+            reply(chan);
+            status = http_500(io);
+            goto exit;
+        }
 
-            /* project the parameter */
-            Rel *param = rel_project(rel_load(fn->rp.head, fn->rp.name),
-                                     fn->rp.head->names,
-                                     fn->rp.head->len);
+        vol_write(w->vols[i], v->vals[idx], w->names[i], w->vers[i]);
+        tbuf_free(v->vals[idx]);
+        v->vals[idx] = NULL;
+    }
 
-            rel_eval(param, v, arg);
+    /* confirm a success and send the result back */
+    reply(chan);
+    status = http_200(io);
+    if (status != 200)
+        goto exit;
 
-            /* clean the previous version */
-            tbuf_clean(body);
-            tbuf_free(body);
+    tx_commit(sid);
 
-            /* replace with the new body */
-            int vpos = array_scan(v->names, v->len, fn->rp.name);
-            v->vals[vpos] = param->body;
+    /* N.B. there is no explicit revert as the transaction manager handles
+       nested tx_enter and a connectivity failure as a rollback */
 
-            param->body = NULL;
-            rel_free(param);
+    int len = 1, i = 0;
+    while (status == 200 && len) {
+        len = pack_rel2csv(ret, res, MAX_BLOCK, i++);
+        status = http_chunk(io, res, len);
+    }
+exit:
+    if (status != -1)
+        sys_log('E', "%016llX method %c, path %s, time %lldms - %3d\n",
+                     sid,
+                     (req == NULL) ? '?' : req->method,
+                     (req == NULL) ? "malformed" : req->path,
+                     sys_millis() - time,
+                     status);
+
+
+    if (r != NULL)
+        vars_free(r);
+    if (w != NULL)
+        vars_free(w);
+    if (arg != NULL)
+        mem_free(arg);
+    if (req != NULL)
+        http_free_req(req);
+    env_reset(env);
+    for (int i = 0; i < v->len; ++i)
+        if (v->vals[i] != NULL) {
+            tbuf_clean(v->vals[i]);
+            tbuf_free(v->vals[i]);
         }
+    vars_free(v);
 
-        /* start a transaction */
-        r = vars_new(fn->r.len);
-        w = vars_new(fn->w.len);
-        for (int i = 0; i < fn->r.len; ++i)
-            vars_add(r, fn->r.names[i], 0, NULL);
-        for (int i = 0; i < fn->w.len; ++i)
-            vars_add(w, fn->w.names[i], 0, NULL);
+    tuple_arena(NULL);
+    arena_reset(a);
+}
 
-        sid = tx_enter(addr, r, w);
+static void processor(const char *tx_addr,
+                      const char *data,
+                      int port,
+                      int chan)
+{
+    sys_init(1);
+    if (chan < 0)
+        sys_log('E', "started port=%d, tx=%s\n", port, tx_addr);
+    else
+        sys_log('E', "started chan=%d, tx=%s\n", chan, tx_addr);
 
-        /* prepare variables */
-        for (int i = 0; i < r->len; ++i) {
-            TBuf *body = vol_read(r->vols[i], r->names[i], r->vers[i]);
-            vars_add(v, r->names[i], 0, body);
-        }
-        for (int i = 0; i < w->len; ++i) {
-            int pos = array_scan(v->names, v->len, w->names[i]);
-            if (pos < 0)
-                vars_add(v, w->names[i], 0, NULL);
-        }
-        for (int i = 0; i < fn->t.len; ++i)
-            vars_add(v, fn->t.names[i], 0, NULL);
-
-        /* evaluate the function body */
-        for (int i = 0; i < fn->slen; ++i)
-            rel_eval(fn->stmts[i], v, arg);
-
-        /* prepare the return value. note, the resulting relation
-           is just a container for the body, so it is not freed */
-        Rel *ret = NULL;
-        if (fn->ret != NULL)
-            ret = fn->stmts[fn->slen - 1];
-
-        /* persist the global variables */
-        for (int i = 0; i < w->len; ++i) {
-            int idx = array_scan(v->names, v->len, w->names[i]);
-            if (idx < 0) {
-                status = http_500(io);
-                goto exit;
-            }
+    /* the volume shares the host, read its files directly */
+    if (data != NULL)
+        vol_local(data);
 
-            vol_write(w->vols[i], v->vals[idx], w->names[i], w->vers[i]);
-            tbuf_free(v->vals[idx]);
-            v->vals[idx] = NULL;
-        }
+    /* connect to the control thread (only the host part of the address
+       matters for the tx, so the channel descriptor stands for the port) */
+    char addr[MAX_ADDR];
+    IO *io = NULL;
+    if (chan < 0) {
+        sys_address(addr, port);
+        io = sys_connect(addr, IO_CHUNK);
+    } else {
+        sys_address(addr, chan);
+        io = sys_chan_open(chan);
+    }
 
-        /* confirm a success and send the result back */
-        status = http_200(io);
-        if (status != 200)
-            goto exit;
+    tx_attach(tx_addr);
 
-        tx_commit(sid);
+    /* get env code from the tx and compile it once for all the requests */
+    char *code = tx_program();
+    Env *env = env_new("net", code);
+    char *res = mem_alloc(MAX_BLOCK);
 
-        /* N.B. there is no explicit revert as the transaction manager handles
-           nested tx_enter and a connectivity failure as a rollback */
+    /* tuples live no longer than the request which created them */
+    Arena *arena = arena_new();
 
-        int len = 1, i = 0;
-        while (status == 200 && len) {
-            len = pack_rel2csv(ret, res, MAX_BLOCK, i++);
-            status = http_chunk(io, res, len);
-        }
-exit:
-        if (status != -1)
-            sys_log('E', "%016llX method %c, path %s, time %lldms - %3d\n",
-                         sid,
-                         (req == NULL) ? '?' : req->method,
-                         (req == NULL) ? "malformed" : req->path,
-                         sys_millis() - time,
-                         status);
-
-
-        if (r != NULL)
-            vars_free(r);
-        if (w != NULL)
-            vars_free(w);
-        if (arg != NULL)
-            mem_free(arg);
-        if (req != NULL)
-            http_free_req(req);
-        if (env != NULL)
-            env_free(env);
-        for (int i = 0; i < v->len; ++i)
-            if (v->vals[i] != NULL) {
-                tbuf_clean(v->vals[i]);
-                tbuf_free(v->vals[i]);
-            }
-        vars_free(v);
+    /* the exec thread waits for the channel to be ready (see exec_pass) */
+    char ready = PROC_READY;
+    if (chan > -1 && sys_write(io, &ready, 1) < 0)
+        io->stop |= IO_ERROR;
 
-        sys_term(io);
-    }
+    if (chan < 0)
+        while (!io->stop) {
+            sys_iready(io, -1);
+            serve(env, addr, io, NULL, res, arena);
+            sys_term(io);
+        }
+    else
+        for (IO *cio; !io->stop && (cio = sys_recv_io(io)) != NULL; ) {
+            serve(env, addr, cio, io, res, arena);
+
+            char stop = cio->stop;
+            sys_close(cio);
+            if (sys_write(io, &stop, 1) < 0)
+                break;
+        }
 
+    arena_free(arena);
+    env_free(env);
     mem_free(code);
     mem_free(res);
     tx_detach();
@@ -485,7 +681,7 @@ static void usage(char *p)
     sys_print("distributed commands:\n");
     sys_print("  tx    -p <port> -c <source.file> -s <state.file>\n");
     sys_print("  vol   -p <port> -d <data.dir> -t <tx.host:port>\n");
-    sys_print("  exec  -p <port> -t <tx.host:port>\n\n");
+    sys_print("  exec  -p <port> -t <tx.host:port> [-d <data.dir>]\n\n");
     sys_print("program converter (v5 syntax):\n");
     sys_print(
 "  convert - transforms v4 programs to the v5 syntax. the source program is\n");
@@ -509,17 +705,33 @@ static int parse_port(char *p)
     return port;
 }
 
-static void multiplex(const char *exe, const char *tx_addr, int port)
+static int parse_chan(char *p)
+{
+    int fd = 0, e = -1;
+    fd = str_int(p, &e);
+    if (e || fd < 0)
+        sys_die("invalid channel '%s'\n", p);
+
+    return fd;
+}
+
+static void multiplex(const char *exe,
+                      const char *tx_addr,
+                      const char *data,
+                      int port)
 {
     Queue *runq = queue_new();
     Queue *waitq = queue_new();
+    Poll *poll = poll_new();
 
     for (int i = 0; i < THREADS; ++i) {
         Exec *e = mem_alloc(sizeof(Exec));
         str_cpy(e->exe, exe);
         str_cpy(e->tx, tx_addr);
+        str_cpy(e->data, data == NULL ? "" : data);
         e->runq = runq;
         e->waitq = waitq;
+        e->poll = poll;
 
         sys_thread(exec_thread, e);
 
@@ -534,15 +746,17 @@ static void multiplex(const char *exe, const char *tx_addr, int port)
     for (;;) {
         IO *io = sys_accept(sio, IO_STREAM);
         queue_put(waitq, conn_new(io));
+        poll_wake(poll);
     }
 
+    poll_free(poll);
     queue_free(waitq);
     queue_free(runq);
 }
 
 int main(int argc, char *argv[])
 {
-    int port = 0;
+    int port = 0, chan = -1;
     char *data = NULL;
     char *state = NULL;
     char *source = NULL;
@@ -561,6 +775,8 @@ int main(int argc, char *argv[])
             state = argv[i + 1];
         else if (str_cmp(argv[i], "-p") == 0)
             port = parse_port(argv[i + 1]);
+        else if (str_cmp(argv[i], "-f") == 0)
+            chan = parse_chan(argv[i + 1]);
         else if (str_cmp(argv[i], "-t") == 0) {
             tx_addr = argv[i + 1];
             if (str_len(tx_addr) >= MAX_ADDR)
@@ -577,13 +793,14 @@ int main(int argc, char *argv[])
 
         char addr[MAX_ADDR];
         str_print(addr, "127.0.0.1:%d", tx_port);
-        multiplex(argv[0], addr, port);
+        multiplex(argv[0], addr, data, port);
 
         tx_free();
     } else if (str_cmp(argv[1], "processor") == 0 && source == NULL &&
-               data == NULL && state == NULL && port != 0 && tx_addr != NULL)
+               state == NULL && (port != 0) != (chan > -1) &&
+               tx_addr != NULL)
     {
-        processor(tx_addr, port);
+        processor(tx_addr, data, port, chan);
     } else if (str_cmp(argv[1], "tx") == 0 && source != NULL &&
                data == NULL && state != NULL && port != 0 && tx_addr == NULL)
     {
@@ -594,10 +811,10 @@ int main(int argc, char *argv[])
         tx_attach(tx_addr);
         vol_init(port, data);
     } else if (str_cmp(argv[1], "exec") == 0 && source == NULL &&
-               data == NULL && state == NULL && port != 0 && tx_addr != NULL)
+               state == NULL && port != 0 && tx_addr != NULL)
     {
         tx_attach(tx_addr);
-        multiplex(argv[0], tx_addr, port);
+        multiplex(argv[0], tx_addr, data, port);
     } else if (str_cmp(argv[1], "convert") == 0 && source == NULL &&
                data == NULL && state == NULL && port == 0 && tx_addr == NULL)
     {
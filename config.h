@@ -43,6 +43,9 @@ limitations under the License.
 /* maximum length of a host:port string */
 #define MAX_ADDR 64
 
+/* number of tuples processed at once by the batch evaluation */
+#define MAX_BATCH 1024
+
 /* maximum header length when transformed into a string '{a string, b int}' */
 #define MAX_HEAD_STR (2 * MAX_ATTRS * MAX_NAME)
 
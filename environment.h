@@ -52,6 +52,7 @@ typedef struct {
         int len;
         char *names[MAX_TYPES];
         Head *heads[MAX_TYPES];
+        Head *indexes[MAX_TYPES]; /* indexed attributes (vars only) */
     } vars, types;
 
     struct {
@@ -64,6 +65,9 @@ typedef struct {
 extern Env *env_new(const char *path, const char *program);
 extern void env_free(Env *env);
 
+/* prepares a compiled environment for the next evaluation */
+extern void env_reset(Env *env);
+
 extern Func *env_func(Env *env, const char *name);
 extern Func **env_funcs(Env *env, const char *name, int *cnt);
 extern Head *env_head(Env *env, const char *var);
@@ -14,7 +14,6 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
-
 #include "config.h"
 #include "system.h"
 #include "string.h"
@@ -22,412 +21,564 @@ limitations under the License.
 #include "head.h"
 #include "value.h"
 #include "tuple.h"
+#include "number.h"
 #include "expression.h"
 
-#define e_int(e) ((e)->val.v_int)
-#define e_real(e) ((e)->val.v_real)
-#define e_long(e) ((e)->val.v_long)
-#define e_str(e) ((e)->val.v_str)
+/* kinds of the expression nodes, also the operations of the bytecode */
+enum { CONST, ATTR, PARAM, TIME, NOT, OR, AND, EQ, LT, LTE, GT, GTE,
+       SUM, SUB, MUL, DIV, TO_INT, TO_REAL, TO_LONG, STR_INDEX };
+
+/* instructions are specialized by the type of their operands */
+#define code(op, type) ((op) << 2 | (type))
+#define each(stmt) for (int i = 0; i < len; ++i) stmt
+
+/* strings are views into the tuples, the arguments or the constants */
+typedef union {
+    int i;
+    double d;
+    long long l;
+    const char *s;
+} Reg;
 
 typedef struct {
-    Expr *left;
-    Expr *right;
-    void (*op)(Expr *dest, Expr *l, Expr *r);
-} C_Binary;
+    int code;
+    int dst;
+    int a; /* left register, or the position of an attribute/parameter */
+    int b; /* right register (the left one for unary instructions) */
+} Ins;
 
-static Expr *do_eval(Expr *e, Tuple *t, Arg *arg)
-{
-    e->eval(e, t, arg);
-    return e;
-}
+typedef struct {
+    int len;
+    Ins *code;
+
+    /* scalar registers, constants are loaded during the compilation */
+    int regs;
+    int res;
+    Reg *r;
+    char *is_const;
 
-static void eval_noop(Expr *e, Tuple *t, Arg *arg) { }
-static void free_noop(Expr *e) { }
+    /* MAX_BATCH values per register, allocated on the first batch */
+    Reg *vec;
+} Prog;
 
-static Expr *alloc(Type type,
-                   int ctxt_size,
-                   void (*eval)(Expr*, Tuple*, Arg*),
-                   void (*free)(Expr*))
+static Expr *alloc(int node, Type type, Expr *l, Expr *r)
 {
-    Expr *res = mem_alloc(sizeof(Expr) + ctxt_size);
+    Expr *res = mem_alloc(sizeof(Expr));
     res->type = type;
-    res->ctxt = ctxt_size > 0 ? res + 1 : 0;
-    res->eval = eval;
-    res->free = free;
+    res->node = node;
+    res->left = l;
+    res->right = r;
+    res->val.v_long = 0;
+    res->prog = NULL;
 
     return res;
 }
 
 extern Expr *expr_int(int val)
 {
-    Expr *res = alloc(Int, 0, eval_noop, free_noop);
-    e_int(res) = val;
+    Expr *res = alloc(CONST, Int, NULL, NULL);
+    res->val.v_int = val;
     return res;
 }
 
 extern Expr *expr_long(long long val)
 {
-    Expr *res = alloc(Long, 0, eval_noop, free_noop);
-    e_long(res) = val;
+    Expr *res = alloc(CONST, Long, NULL, NULL);
+    res->val.v_long = val;
     return res;
 }
 
 extern Expr *expr_real(double val)
 {
-    Expr *res = alloc(Real, 0, eval_noop, free_noop);
-    e_real(res) = val;
+    Expr *res = alloc(CONST, Real, NULL, NULL);
+    res->val.v_real = val;
     return res;
 }
 
 extern Expr *expr_str(const char *val)
 {
-    Expr *res = alloc(String, 0, eval_noop, free_noop);
-    str_cpy(e_str(res), val);
+    Expr *res = alloc(CONST, String, NULL, NULL);
+    res->val.v_str = mem_alloc(str_len(val) + 1);
+    str_cpy(res->val.v_str, val);
     return res;
 }
 
-static void eval_attr(Expr *e, Tuple *t, Arg *arg)
-{
-    Value v = tuple_attr(t, *((int*) e->ctxt));
-    if (e->type == Int)
-        e_int(e) = val_int(v);
-    else if (e->type == Real)
-        e_real(e) = val_real(v);
-    else if (e->type == Long)
-        e_long(e) = val_long(v);
-    else if (e->type == String)
-        str_cpy(e_str(e), val_str(v));
-}
-
 extern Expr *expr_attr(int pos, Type type)
 {
-    Expr *res = alloc(type, sizeof(int), eval_attr, free_noop);
-    *((int*) res->ctxt) = pos;
+    Expr *res = alloc(ATTR, type, NULL, NULL);
+    res->val.v_int = pos;
     return res;
 }
 
-static void eval_param(Expr *e, Tuple *t, Arg *arg)
-{
-    int i = *((int*) e->ctxt);
-    if (e->type == Int)
-        e_int(e) = arg->vals[i].v_int;
-    else if (e->type == Real)
-        e_real(e) = arg->vals[i].v_real;
-    else if (e->type == Long)
-        e_long(e) = arg->vals[i].v_long;
-    else if (e->type == String)
-        str_cpy(e_str(e), arg->vals[i].v_str);
-}
-
 extern Expr *expr_param(int pos, Type type)
 {
-    Expr *res = alloc(type, sizeof(int), eval_param, free_noop);
-    *((int*) res->ctxt) = pos;
+    Expr *res = alloc(PARAM, type, NULL, NULL);
+    res->val.v_int = pos;
     return res;
 }
 
-static void eval_not(Expr *e, Tuple *t, Arg *arg)
+extern Expr *expr_not(Expr *e)
 {
-    e_int(e) = !e_int(do_eval(e->ctxt, t, arg));
+    return alloc(NOT, Int, e, NULL);
 }
 
-static void free_unary(Expr *e)
+extern Expr *expr_or(Expr *l, Expr *r)
 {
-    expr_free(e->ctxt);
+    return alloc(OR, Int, l, r);
 }
 
-extern Expr *expr_not(Expr *e)
+extern Expr *expr_and(Expr *l, Expr *r)
 {
-    Expr *res = alloc(Int, 0, eval_not, free_unary);
-    res->ctxt = e;
-    return res;
+    return alloc(AND, Int, l, r);
 }
 
-static void eval_binary(Expr *e, Tuple *t, Arg *arg)
+extern Expr *expr_eq(Expr *l, Expr *r)
 {
-    C_Binary *c = e->ctxt;
-    c->op(e, do_eval(c->left, t, arg), do_eval(c->right, t, arg));
+    return alloc(EQ, Int, l, r);
 }
 
-static void free_binary(Expr *e)
+extern Expr *expr_lt(Expr *l, Expr *r)
 {
-    C_Binary *c = e->ctxt;
-    expr_free(c->left);
-    expr_free(c->right);
+    return alloc(LT, Int, l, r);
 }
 
-static Expr *expr_binary(Type type,
-                         Expr *left,
-                         Expr *right,
-                         void (*op)(Expr *dest, Expr *l, Expr *r))
+extern Expr *expr_lte(Expr *l, Expr *r)
 {
-    Expr *res = alloc(type, sizeof(C_Binary), eval_binary, free_binary);
-
-    C_Binary *c = res->ctxt;
-    c->left = left;
-    c->right = right;
-    c->op = op;
-
-    return res;
+    return alloc(LTE, Int, l, r);
 }
 
-static void op_or(Expr *dest, Expr *l, Expr *r)
+extern Expr *expr_gt(Expr *l, Expr *r)
 {
-    e_int(dest) = e_int(l) || e_int(r);
+    return alloc(GT, Int, l, r);
 }
 
-extern Expr *expr_or(Expr *l, Expr *r)
+extern Expr *expr_gte(Expr *l, Expr *r)
 {
-    return expr_binary(Int, l, r, op_or);
+    return alloc(GTE, Int, l, r);
 }
 
-static void op_and(Expr *dest, Expr *l, Expr *r)
+extern Expr *expr_sum(Expr *l, Expr *r)
 {
-    e_int(dest) = e_int(l) && e_int(r);
+    return alloc(SUM, l->type, l, r);
 }
 
-extern Expr *expr_and(Expr *l, Expr *r)
+extern Expr *expr_sub(Expr *l, Expr *r)
 {
-    return expr_binary(Int, l, r, op_and);
+    return alloc(SUB, l->type, l, r);
 }
 
-static int cmp(Expr *l, Expr *r)
+extern Expr *expr_div(Expr *l, Expr *r)
 {
-    int res;
-    switch (l->type) {
-        case Int:
-            if (e_int(l) == e_int(r))
-                res = 0;
-            else
-                res = e_int(l) > e_int(r) ? 1 : -1;
-            break;
-        case Real:
-            if (e_real(l) == e_real(r))
-                res = 0;
-            else
-                res = e_real(l) > e_real(r) ? 1 : -1;
-            break;
-        case Long:
-            if (e_long(l) == e_long(r))
-                res = 0;
-            else
-                res = e_long(l) > e_long(r) ? 1 : -1;
-            break;
-        default:
-            res = str_cmp(e_str(l), e_str(r));
-    }
-
-    return res;
+    return alloc(DIV, l->type, l, r);
 }
 
-static void op_eq(Expr *dest, Expr *l, Expr *r)
+extern Expr *expr_mul(Expr *l, Expr *r)
 {
-    e_int(dest) = cmp(l, r) == 0;
+    return alloc(MUL, l->type, l, r);
 }
 
-extern Expr *expr_eq(Expr *l, Expr *r)
+/* TODO: implement to/from string conversions and string concatenation */
+extern Expr *expr_conv(Expr *e, Type t)
 {
-    return expr_binary(Int, l, r, op_eq);
-}
+    int node = TO_INT;
+    if (t == Real)
+        node = TO_REAL;
+    else if (t == Long)
+        node = TO_LONG;
 
-static void op_lt(Expr *dest, Expr *l, Expr *r)
-{
-    e_int(dest) = cmp(l, r) < 0;
+    return alloc(node, t, e, NULL);
 }
 
-extern Expr *expr_lt(Expr *l, Expr *r)
+extern Expr *expr_time()
 {
-    return expr_binary(Int, l, r, op_lt);
+    return alloc(TIME, Long, NULL, NULL);
 }
 
-static void op_lte(Expr *dest, Expr *l, Expr *r)
+extern Expr *expr_str_index(Expr *l, Expr *r)
 {
-    e_int(dest) = cmp(l, r) <= 0;
+    return alloc(STR_INDEX, Int, l, r);
 }
 
-extern Expr *expr_lte(Expr *l, Expr *r)
+static int rcmp(double l, double r)
 {
-    return expr_binary(Int, l, r, op_lte);
-}
+    if (l == r)
+        return 0;
 
-static void op_gt(Expr *dest, Expr *l, Expr *r)
-{
-    e_int(dest) = cmp(l, r) > 0;
+    return l > r ? 1 : -1;
 }
 
-extern Expr *expr_gt(Expr *l, Expr *r)
+/* executes the instruction for len tuples, each register holds stride
+   values (1 for the scalar evaluation) */
+static void exec(Ins *in, Reg *regs, int stride, Tuple *ts[], int len, Arg *arg)
 {
-    return expr_binary(Int, l, r, op_gt);
-}
+    int op = in->code >> 2;
+    Reg *d = regs + in->dst * stride, *x = NULL, *y = NULL;
+    if (op >= NOT) {
+        x = regs + in->a * stride;
+        y = regs + in->b * stride;
+    }
 
-static void op_gte(Expr *dest, Expr *l, Expr *r)
-{
-    e_int(dest) = cmp(l, r) >= 0;
-}
+    if (op == ATTR) {
+        void *data[len];
+        tuple_attrs(ts, len, in->a, data);
 
-extern Expr *expr_gte(Expr *l, Expr *r)
-{
-    return expr_binary(Int, l, r, op_gte);
-}
+        switch (in->code) {
+            case code(ATTR, Int): each(d[i].i = int_dec(data[i])); break;
+            case code(ATTR, Real): each(d[i].d = real_dec(data[i])); break;
+            case code(ATTR, Long): each(d[i].l = long_dec(data[i])); break;
+            case code(ATTR, String): each(d[i].s = data[i]); break;
+        }
 
-static void op_sum(Expr *dest, Expr *l, Expr *r)
-{
-    if (l->type == Int)
-        e_int(dest) = e_int(l) + e_int(r);
-    else if (l->type == Long)
-        e_long(dest) = e_long(l) + e_long(r);
-    else
-        e_real(dest) = e_real(l) + e_real(r);
-}
+        return;
+    }
 
-extern Expr *expr_sum(Expr *l, Expr *r)
-{
-    return expr_binary(l->type, l, r, op_sum);
+    switch (in->code) {
+        case code(PARAM, Int): each(d[i].i = arg->vals[in->a].v_int); break;
+        case code(PARAM, Real): each(d[i].d = arg->vals[in->a].v_real); break;
+        case code(PARAM, Long): each(d[i].l = arg->vals[in->a].v_long); break;
+        case code(PARAM, String): each(d[i].s = arg->vals[in->a].v_str); break;
+        case code(TIME, Long): {
+            long long now = sys_millis();
+            each(d[i].l = now);
+            break;
+        }
+
+        case code(NOT, Int): each(d[i].i = !x[i].i); break;
+        case code(OR, Int): each(d[i].i = x[i].i || y[i].i); break;
+        case code(AND, Int): each(d[i].i = x[i].i && y[i].i); break;
+
+        case code(EQ, Int): each(d[i].i = x[i].i == y[i].i); break;
+        case code(EQ, Real): each(d[i].i = x[i].d == y[i].d); break;
+        case code(EQ, Long): each(d[i].i = x[i].l == y[i].l); break;
+        case code(EQ, String):
+            each(d[i].i = str_cmp(x[i].s, y[i].s) == 0);
+            break;
+        case code(LT, Int): each(d[i].i = x[i].i < y[i].i); break;
+        case code(LT, Real): each(d[i].i = rcmp(x[i].d, y[i].d) < 0); break;
+        case code(LT, Long): each(d[i].i = x[i].l < y[i].l); break;
+        case code(LT, String):
+            each(d[i].i = str_cmp(x[i].s, y[i].s) < 0);
+            break;
+        case code(LTE, Int): each(d[i].i = x[i].i <= y[i].i); break;
+        case code(LTE, Real): each(d[i].i = rcmp(x[i].d, y[i].d) <= 0); break;
+        case code(LTE, Long): each(d[i].i = x[i].l <= y[i].l); break;
+        case code(LTE, String):
+            each(d[i].i = str_cmp(x[i].s, y[i].s) <= 0);
+            break;
+        case code(GT, Int): each(d[i].i = x[i].i > y[i].i); break;
+        case code(GT, Real): each(d[i].i = rcmp(x[i].d, y[i].d) > 0); break;
+        case code(GT, Long): each(d[i].i = x[i].l > y[i].l); break;
+        case code(GT, String):
+            each(d[i].i = str_cmp(x[i].s, y[i].s) > 0);
+            break;
+        case code(GTE, Int): each(d[i].i = x[i].i >= y[i].i); break;
+        case code(GTE, Real): each(d[i].i = rcmp(x[i].d, y[i].d) >= 0); break;
+        case code(GTE, Long): each(d[i].i = x[i].l >= y[i].l); break;
+        case code(GTE, String):
+            each(d[i].i = str_cmp(x[i].s, y[i].s) >= 0);
+            break;
+
+        case code(SUM, Int): each(d[i].i = x[i].i + y[i].i); break;
+        case code(SUM, Real): each(d[i].d = x[i].d + y[i].d); break;
+        case code(SUM, Long): each(d[i].l = x[i].l + y[i].l); break;
+        case code(SUB, Int): each(d[i].i = x[i].i - y[i].i); break;
+        case code(SUB, Real): each(d[i].d = x[i].d - y[i].d); break;
+        case code(SUB, Long): each(d[i].l = x[i].l - y[i].l); break;
+        case code(MUL, Int): each(d[i].i = x[i].i * y[i].i); break;
+        case code(MUL, Real): each(d[i].d = x[i].d * y[i].d); break;
+        case code(MUL, Long): each(d[i].l = x[i].l * y[i].l); break;
+        case code(DIV, Int): each(d[i].i = x[i].i / y[i].i); break;
+        case code(DIV, Real): each(d[i].d = x[i].d / y[i].d); break;
+        case code(DIV, Long): each(d[i].l = x[i].l / y[i].l); break;
+
+        case code(TO_INT, Int): each(d[i].i = x[i].i); break;
+        case code(TO_INT, Real): each(d[i].i = (int) x[i].d); break;
+        case code(TO_INT, Long): each(d[i].i = (int) x[i].l); break;
+        case code(TO_REAL, Int): each(d[i].d = (double) x[i].i); break;
+        case code(TO_REAL, Real): each(d[i].d = x[i].d); break;
+        case code(TO_REAL, Long): each(d[i].d = (double) x[i].l); break;
+        case code(TO_LONG, Int): each(d[i].l = x[i].i); break;
+        case code(TO_LONG, Real): each(d[i].l = (long long) x[i].d); break;
+        case code(TO_LONG, Long): each(d[i].l = x[i].l); break;
+
+        case code(STR_INDEX, String):
+            each(d[i].i = (int) str_idx(x[i].s, y[i].s));
+            break;
+    }
 }
 
-static void op_sub(Expr *dest, Expr *l, Expr *r)
+static int count(Expr *e)
 {
-    if (l->type == Int)
-        e_int(dest) = e_int(l) - e_int(r);
-    else if (l->type == Long)
-        e_long(dest) = e_long(l) - e_long(r);
-    else
-        e_real(dest) = e_real(l) - e_real(r);
+    int res = 1;
+    if (e->left != NULL)
+        res += count(e->left);
+    if (e->right != NULL)
+        res += count(e->right);
+
+    return res;
 }
 
-extern Expr *expr_sub(Expr *l, Expr *r)
+/* returns the register holding the result of the expression */
+static int emit(Prog *p, Expr *e)
 {
-    return expr_binary(l->type, l, r, op_sub);
+    if (e->node == CONST) {
+        int dst = p->regs++;
+        p->is_const[dst] = 1;
+        if (e->type == Int)
+            p->r[dst].i = e->val.v_int;
+        else if (e->type == Real)
+            p->r[dst].d = e->val.v_real;
+        else if (e->type == Long)
+            p->r[dst].l = e->val.v_long;
+        else if (e->type == String)
+            p->r[dst].s = e->val.v_str;
+
+        return dst;
+    }
+
+    int a = 0, b = 0;
+    Type t = e->type;
+    if (e->node == ATTR || e->node == PARAM)
+        a = e->val.v_int;
+    if (e->left != NULL) {
+        a = b = emit(p, e->left);
+        t = e->left->type;
+    }
+    if (e->right != NULL)
+        b = emit(p, e->right);
+
+    int dst = p->regs++;
+    p->is_const[dst] = 0;
+
+    Ins *in = p->code + p->len++;
+    in->code = code(e->node, t);
+    in->dst = dst;
+    in->a = a;
+    in->b = b;
+
+    /* operations over constants are folded (except for a division by zero,
+       which is left to fail during the evaluation) */
+    int fold = e->left != NULL && p->is_const[a] && p->is_const[b];
+    if (fold && e->node == DIV && t == Int)
+        fold = p->r[b].i != 0;
+    else if (fold && e->node == DIV && t == Long)
+        fold = p->r[b].l != 0;
+
+    if (fold) {
+        exec(in, p->r, 1, NULL, 1, NULL);
+        p->is_const[dst] = 1;
+        p->len--;
+    }
+
+    return dst;
 }
 
-static void op_div(Expr *dest, Expr *l, Expr *r)
+static Prog *compile(Expr *e)
 {
-    if (l->type == Int)
-        e_int(dest) = e_int(l) / e_int(r);
-    else if (l->type == Long)
-        e_long(dest) = e_long(l) / e_long(r);
-    else
-        e_real(dest) = e_real(l) / e_real(r);
+    int n = count(e);
+    Prog *p = mem_alloc(sizeof(Prog) + n * (sizeof(Ins) + sizeof(Reg) + 1));
+    p->code = (Ins*) (p + 1);
+    p->r = (Reg*) (p->code + n);
+    p->is_const = (char*) (p->r + n);
+    p->len = 0;
+    p->regs = 0;
+    p->vec = NULL;
+    p->res = emit(p, e);
+
+    return p;
 }
 
-extern Expr *expr_div(Expr *l, Expr *r)
+static Prog *run(Expr *e, Tuple *t, Arg *arg)
 {
-    return expr_binary(l->type, l, r, op_div);
+    if (e->prog == NULL)
+        e->prog = compile(e);
+
+    Prog *p = e->prog;
+    for (int i = 0; i < p->len; ++i)
+        exec(p->code + i, p->r, 1, &t, 1, arg);
+
+    return p;
 }
 
-static void op_mul(Expr *dest, Expr *l, Expr *r)
+extern int expr_bool_val(Expr *e, Tuple *t, Arg *arg)
 {
-    if (l->type == Int)
-        e_int(dest) = e_int(l) * e_int(r);
-    else if (l->type == Long)
-        e_long(dest) = e_long(l) * e_long(r);
-    else
-        e_real(dest) = e_real(l) * e_real(r);
+    Prog *p = run(e, t, arg);
+    return p->r[p->res].i;
 }
 
-extern Expr *expr_mul(Expr *l, Expr *r)
+static Value reg_val(Type type, Reg *r)
 {
-    return expr_binary(l->type, l, r, op_mul);
+    Value v = {.size = 0, .data = NULL };
+    if (type == Int)
+        v = val_new_int(&r->i);
+    else if (type == Real)
+        v = val_new_real(&r->d);
+    else if (type == Long)
+        v = val_new_long(&r->l);
+    else if (type == String)
+        v = val_new_str((char*) r->s);
+
+    return v;
 }
 
-static void eval_to_int(Expr *dest, Tuple *t, Arg *arg)
+extern Value expr_new_val(Expr *e, Tuple *t, Arg *arg)
 {
-    Expr *src = do_eval(dest->ctxt, t, arg);
-    if (src->type == Int)
-        e_int(dest) = e_int(src);
-    else if (src->type == Real)
-        e_int(dest) = (int) e_real(src);
-    else if (src->type == Long)
-        e_int(dest) = (int) e_long(src);
+    Prog *p = run(e, t, arg);
+    return reg_val(e->type, p->r + p->res);
 }
 
-static void eval_to_real(Expr *dest, Tuple *t, Arg *arg)
+extern void expr_batch(Expr *e, Tuple *ts[], int len, Arg *arg)
 {
-    Expr *src = do_eval(dest->ctxt, t, arg);
-    if (src->type == Int)
-        e_real(dest) = (double) e_int(src);
-    else if (src->type == Real)
-        e_real(dest) = e_real(src);
-    else if (src->type == Long)
-        e_real(dest) = (double) e_long(src);
+    if (e->prog == NULL)
+        e->prog = compile(e);
+
+    Prog *p = e->prog;
+    if (p->vec == NULL) {
+        p->vec = mem_alloc(sizeof(Reg) * MAX_BATCH * p->regs);
+        for (int r = 0; r < p->regs; ++r)
+            if (p->is_const[r])
+                for (int i = 0; i < MAX_BATCH; ++i)
+                    p->vec[r * MAX_BATCH + i] = p->r[r];
+    }
+
+    for (int i = 0; i < p->len; ++i)
+        exec(p->code + i, p->vec, MAX_BATCH, ts, len, arg);
 }
 
-static void eval_to_long(Expr *dest, Tuple *t, Arg *arg)
+extern Value expr_batch_val(Expr *e, int i)
 {
-    Expr *src = do_eval(dest->ctxt, t, arg);
-    if (src->type == Int)
-        e_long(dest) = e_int(src);
-    else if (src->type == Real)
-        e_long(dest) = (long long) e_real(src);
-    else if (src->type == Long)
-        e_long(dest) = e_long(src);
+    Prog *p = e->prog;
+    return reg_val(e->type, p->vec + p->res * MAX_BATCH + i);
 }
 
-/* TODO: implement to/from string conversions and string concatenation */
-extern Expr *expr_conv(Expr *e, Type t)
+extern int expr_batch_sel(Expr *e, Tuple *ts[], int len, Arg *arg, int sel[])
 {
-    void (*eval)(Expr *self, Tuple *t, Arg *arg) = NULL;
-    if (t == Int)
-        eval = eval_to_int;
-    else if (t == Real)
-        eval = eval_to_real;
-    else if (t == Long)
-        eval = eval_to_long;
+    expr_batch(e, ts, len, arg);
 
-    Expr *res = alloc(t, 0, eval, free_unary);
-    res->ctxt = e;
+    Prog *p = e->prog;
+    Reg *res = p->vec + p->res * MAX_BATCH;
 
-    return res;
+    int cnt = 0;
+    for (int i = 0; i < len; ++i) {
+        sel[cnt] = i;
+        cnt += res[i].i != 0;
+    }
+
+    return cnt;
 }
 
-static void eval_time(Expr *e, Tuple *t, Arg *arg)
+extern void expr_attrs(Expr *e, int used[])
 {
-    e_long(e) = sys_millis();
+    if (e->node == ATTR)
+        used[e->val.v_int] = 1;
+    if (e->left != NULL)
+        expr_attrs(e->left, used);
+    if (e->right != NULL)
+        expr_attrs(e->right, used);
 }
 
-extern Expr *expr_time(long long val)
+static int is_fixed(Expr *e)
 {
-    Expr *res = alloc(Long, 0, eval_time, free_noop);
-    return res;
+    if (e->node == ATTR || e->node == TIME)
+        return 0;
+
+    return (e->left == NULL || is_fixed(e->left)) &&
+           (e->right == NULL || is_fixed(e->right));
 }
 
-static void op_str_index(Expr *dest, Expr *l, Expr *r)
+static void bounds(Expr *e, int *pos, Expr **min, Expr **max)
 {
-    char *lstr = e_str(l);
-    char *rstr = e_str(r);
+    if (e->node == AND) {
+        bounds(e->left, pos, min, max);
+        bounds(e->right, pos, min, max);
+        return;
+    }
+
+    int node = e->node;
+    if (node != EQ && node != LT && node != LTE && node != GT && node != GTE)
+        return;
+
+    /* "e < attr" is the same as "attr > e" */
+    Expr *a = e->left, *v = e->right;
+    if (a->node != ATTR) {
+        a = e->right;
+        v = e->left;
+        if (node == LT || node == LTE)
+            node = node == LT ? GT : GTE;
+        else if (node == GT || node == GTE)
+            node = node == GT ? LT : LTE;
+    }
+    if (a->node != ATTR || !is_fixed(v))
+        return;
+    if (*pos > -1 && *pos != a->val.v_int)
+        return;
 
-    e_int(dest) = (int) str_idx(lstr, rstr);
+    /* an equality is the tightest bound there is */
+    *pos = a->val.v_int;
+    if (node == EQ)
+        *min = *max = v;
+    else if ((node == GT || node == GTE) && *min == NULL)
+        *min = v;
+    else if ((node == LT || node == LTE) && *max == NULL)
+        *max = v;
 }
 
-extern Expr *expr_str_index(Expr *l, Expr *r)
+extern int expr_range(Expr *e, int *pos, Expr **min, Expr **max)
 {
-    return expr_binary(Int, l, r, op_str_index);
+    *min = *max = NULL;
+    bounds(e, pos, min, max);
+
+    return *min != NULL || *max != NULL;
 }
 
-extern int expr_bool_val(Expr *e, Tuple *t, Arg *arg)
+extern void expr_remap(Expr *e, int map[])
 {
-    return e_int(do_eval(e, t, arg));
+    if (e->node == ATTR)
+        e->val.v_int = map[e->val.v_int];
+    if (e->left != NULL)
+        expr_remap(e->left, map);
+    if (e->right != NULL)
+        expr_remap(e->right, map);
+
+    /* the positions are part of the code */
+    Prog *p = e->prog;
+    if (p != NULL) {
+        if (p->vec != NULL)
+            mem_free(p->vec);
+        mem_free(p);
+        e->prog = NULL;
+    }
 }
 
-extern Value expr_new_val(Expr *e, Tuple *t, Arg *arg)
+extern Expr *expr_cpy(Expr *e)
 {
-    do_eval(e, t, arg);
+    Expr *l = e->left == NULL ? NULL : expr_cpy(e->left);
+    Expr *r = e->right == NULL ? NULL : expr_cpy(e->right);
 
-    Value v = {.size = 0, .data = NULL };
-    if (e->type == Int)
-        v = val_new_int(&(e_int(e)));
-    else if (e->type == Real)
-        v = val_new_real(&(e_real(e)));
-    else if (e->type == Long)
-        v = val_new_long(&(e_long(e)));
-    else if (e->type == String)
-        v = val_new_str(e_str(e));
+    if (e->node == CONST && e->type == String)
+        return expr_str(e->val.v_str);
 
-    return v;
+    Expr *res = alloc(e->node, e->type, l, r);
+    res->val = e->val;
+
+    return res;
 }
 
 extern void expr_free(Expr *e)
 {
-    e->free(e);
+    if (e->left != NULL)
+        expr_free(e->left);
+    if (e->right != NULL)
+        expr_free(e->right);
+    if (e->node == CONST && e->type == String)
+        mem_free(e->val.v_str);
+
+    Prog *p = e->prog;
+    if (p != NULL) {
+        if (p->vec != NULL)
+            mem_free(p->vec);
+        mem_free(p);
+    }
+
     mem_free(e);
 }
@@ -24,18 +24,22 @@ typedef struct {
     } vals[MAX_ATTRS];
 } Arg;
 
+/* expressions are compiled into bytecode on the first evaluation */
 struct Expr {
     Type type;
-    void *ctxt;
+    int node;
+    struct Expr *left;
+    struct Expr *right;
+
+    /* constant value, or the position of an attribute or a parameter */
     union {
         int v_int;
         double v_real;
         long long v_long;
-        char v_str[MAX_STRING];
+        char *v_str;
     } val;
 
-    void (*eval)(struct Expr *self, Tuple *t, Arg *arg);
-    void (*free)(struct Expr *self);
+    void *prog;
 };
 
 typedef struct Expr Expr;
@@ -64,4 +68,27 @@ extern Expr *expr_str_index(Expr *l, Expr *r);
 
 extern int expr_bool_val(Expr *e, Tuple *t, Arg *arg);
 extern Value expr_new_val(Expr *e, Tuple *t, Arg *arg);
+
+/* batch evaluation over len (up to MAX_BATCH) tuples. expr_batch_val
+   returns the value for the i-th tuple of the last batch, and
+   expr_batch_sel stores the positions of the tuples satisfying a boolean
+   expression into sel and returns their number */
+extern void expr_batch(Expr *e, Tuple *ts[], int len, Arg *arg);
+extern Value expr_batch_val(Expr *e, int i);
+extern int expr_batch_sel(Expr *e, Tuple *ts[], int len, Arg *arg, int sel[]);
+
+/* used[pos] is set for each attribute the expression refers to, and
+   expr_remap moves every attribute from pos to map[pos] */
+extern void expr_attrs(Expr *e, int used[]);
+extern void expr_remap(Expr *e, int map[]);
+extern Expr *expr_cpy(Expr *e);
+
+/* finds the conjuncts comparing an attribute with an expression e which
+   has the same value for all tuples ("attr == e", "attr < e", "e <= attr"
+   and so on). min and max are set to the lower and the upper bound (NULL
+   if there is none, a strict bound is taken as an inclusive one), pos to
+   the position of the attribute (if pos is not negative only that
+   attribute is looked for). returns 0 if there are no bounds. */
+extern int expr_range(Expr *e, int *pos, Expr **min, Expr **max);
+
 extern void expr_free(Expr *e);
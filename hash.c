@@ -0,0 +1,135 @@
+/*
+Copyright 2012 Ostap Cherkashin
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "config.h"
+#include "system.h"
+#include "memory.h"
+#include "head.h"
+#include "value.h"
+#include "tuple.h"
+#include "hash.h"
+
+static void rehash(Hash *h, int buckets)
+{
+    if (h->buckets != NULL)
+        mem_free(h->buckets);
+
+    h->mask = buckets - 1;
+    h->buckets = mem_alloc(buckets * sizeof(int));
+    for (int i = 0; i < buckets; ++i)
+        h->buckets[i] = -1;
+
+    for (int i = 0; i < h->len; ++i) {
+        int b = h->codes[i] & h->mask;
+        h->next[i] = h->buckets[b];
+        h->buckets[b] = i;
+    }
+}
+
+static void grow(Hash *h, int size)
+{
+    h->size = size;
+    h->next = mem_realloc(h->next, size * sizeof(int));
+    h->codes = mem_realloc(h->codes, size * sizeof(unsigned int));
+    h->tuples = mem_realloc(h->tuples, size * sizeof(Tuple*));
+
+    /* keep the load factor below 0.5 */
+    int buckets = h->mask + 1;
+    while (buckets < 2 * size)
+        buckets *= 2;
+
+    if (buckets != h->mask + 1)
+        rehash(h, buckets);
+}
+
+extern Hash *hash_new(int pos[], int len, int hint)
+{
+    Hash *res = mem_alloc(sizeof(Hash));
+    res->len = 0;
+    res->size = 0;
+    res->mask = 0;
+    res->buckets = NULL;
+    res->next = NULL;
+    res->codes = NULL;
+    res->tuples = NULL;
+
+    res->plen = len;
+    for (int i = 0; i < len; ++i)
+        res->pos[i] = pos[i];
+
+    rehash(res, 1);
+    grow(res, hint < 16 ? 16 : hint);
+
+    return res;
+}
+
+extern Hash *hash_build(TBuf *buf, int pos[], int len)
+{
+    Hash *res = hash_new(pos, len, buf->len);
+    for (int i = 0; i < buf->len; ++i)
+        hash_add(res, buf->buf[i]);
+
+    return res;
+}
+
+extern void hash_add(Hash *h, Tuple *t)
+{
+    if (h->len == h->size)
+        grow(h, 2 * h->size);
+
+    int i = h->len++;
+    h->tuples[i] = t;
+    h->codes[i] = tuple_hash(t, h->pos, h->plen);
+
+    int b = h->codes[i] & h->mask;
+    h->next[i] = h->buckets[b];
+    h->buckets[b] = i;
+}
+
+static int match(Hash *h, int idx, unsigned int code, Tuple *t, int tpos[])
+{
+    for (; idx > -1; idx = h->next[idx])
+        if (h->codes[idx] == code &&
+            tuple_cmp(h->tuples[idx], t, h->pos, tpos, h->plen) == 0)
+            break;
+
+    return idx;
+}
+
+extern int hash_find(Hash *h, Tuple *t, int tpos[])
+{
+    unsigned int code = tuple_hash(t, tpos, h->plen);
+    return match(h, h->buckets[code & h->mask], code, t, tpos);
+}
+
+extern int hash_next(Hash *h, int idx, Tuple *t, int tpos[])
+{
+    return match(h, h->next[idx], h->codes[idx], t, tpos);
+}
+
+extern int hash_has(Hash *h, Tuple *t, int tpos[])
+{
+    return hash_find(h, t, tpos) > -1;
+}
+
+extern void hash_free(Hash *h)
+{
+    mem_free(h->buckets);
+    mem_free(h->next);
+    mem_free(h->codes);
+    mem_free(h->tuples);
+    mem_free(h);
+}
@@ -0,0 +1,48 @@
+/*
+Copyright 2012 Ostap Cherkashin
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* a hash table of tuples keyed on the attributes at positions pos. the
+   table references the tuples, it does not own (nor free) them. */
+typedef struct {
+    int len;
+    int size;
+    int mask;
+    int *buckets;
+    int *next;
+    unsigned int *codes;
+    Tuple **tuples;
+
+    int plen;
+    int pos[MAX_ATTRS];
+} Hash;
+
+/* creates an empty table, hint is the expected number of tuples */
+extern Hash *hash_new(int pos[], int len, int hint);
+
+/* creates a table with all the tuples from the buffer */
+extern Hash *hash_build(TBuf *buf, int pos[], int len);
+
+extern void hash_add(Hash *h, Tuple *t);
+extern void hash_free(Hash *h);
+
+/* returns the index (in h->tuples) of the first tuple matching t on the
+   positions tpos, or -1 if there is no such tuple */
+extern int hash_find(Hash *h, Tuple *t, int tpos[]);
+
+/* returns the index of the next tuple after idx matching t, or -1 */
+extern int hash_next(Hash *h, int idx, Tuple *t, int tpos[]);
+
+extern int hash_has(Hash *h, Tuple *t, int tpos[]);
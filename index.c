@@ -6,55 +6,195 @@
 #include "tuple.h"
 #include "index.h"
 
-static void merge(Tuple *keys[],
-                  Tuple *tmp[],
-                  int pos[],
-                  int len,
-                  int left,
-                  int mid,
-                  int right)
+/* ranges shorter than RADIX_MIN are merge sorted, and so are the ones
+   split more than MAX_SPLITS times by the radix sort (long common keys) */
+#define RADIX_MIN 64
+#define MAX_SPLITS 16
+
+/* buffers of at least PARALLEL_MIN tuples are sorted in up to MAX_PARTS
+   parts at once, which are then merged */
+#define PARALLEL_MIN 32768
+#define MAX_PARTS 8
+
+/* the key of a tuple is built once for a sort, so comparisons are mem_cmp
+   calls instead of walking the attributes of both tuples */
+typedef struct {
+    Tuple *t;
+    unsigned char *data;
+    int size;
+} Key;
+
+static int key_cmp(Key *l, Key *r)
+{
+    int res = mem_cmp(l->data, r->data, l->size < r->size ? l->size : r->size);
+    return res != 0 ? res : l->size - r->size;
+}
+
+static void merge(Key keys[], Key tmp[], int left, int mid, int right)
 {
-    int llen = mid - left;
-    int rlen = right - mid;
-
-    Tuple **l = tmp;
-    Tuple **r = tmp + llen + 1;
-    for (int i = 0; i < llen; ++i)
-        l[i] = keys[left + i];
-    for (int i = 0; i < rlen; ++i)
-        r[i] = keys[mid + i];
-    l[llen] = NULL;
-    r[rlen] = NULL;
-
-    int i = 0, j = 0, k = left;
-    while (l[i] != NULL && r[j] != NULL)
-        if (tuple_cmp(l[i], r[j], pos, pos, len) <= 0)
-            keys[k++] = l[i++];
+    for (int i = left; i < right; ++i)
+        tmp[i] = keys[i];
+
+    int i = left, j = mid, k = left;
+    while (i < mid && j < right)
+        if (key_cmp(tmp + i, tmp + j) <= 0)
+            keys[k++] = tmp[i++];
         else
-            keys[k++] = r[j++];
+            keys[k++] = tmp[j++];
 
-    while (l[i] != NULL)
-        keys[k++] = l[i++];
-    while (r[j] != NULL)
-        keys[k++] = r[j++];
+    while (i < mid)
+        keys[k++] = tmp[i++];
+    while (j < right)
+        keys[k++] = tmp[j++];
 }
 
-static void sort(Tuple *keys[],
-                 Tuple *tmp[],
-                 int pos[],
-                 int len,
-                 int left,
-                 int right)
+static void sort(Key keys[], Key tmp[], int left, int right)
 {
     int elems = right - left;
     if (elems < 2)
         return;
 
     int mid = left + elems / 2;
-    sort(keys, tmp, pos, len, left, mid);
-    sort(keys, tmp, pos, len, mid, right);
+    sort(keys, tmp, left, mid);
+    sort(keys, tmp, mid, right);
+
+    merge(keys, tmp, left, mid, right);
+}
+
+/* the byte of a key at depth, 0 when the key is shorter */
+static int key_byte(Key *k, int depth)
+{
+    return depth < k->size ? k->data[depth] + 1 : 0;
+}
+
+/* most significant byte first radix sort (stable) */
+static void radix(Key keys[], Key tmp[], int left, int right, int depth,
+                  int splits)
+{
+    int count[257];
+    for (;;) {
+        if (right - left < RADIX_MIN || splits > MAX_SPLITS) {
+            sort(keys, tmp, left, right);
+            return;
+        }
+
+        for (int b = 0; b < 257; ++b)
+            count[b] = 0;
+        for (int i = left; i < right; ++i)
+            count[key_byte(keys + i, depth)]++;
+
+        /* a byte shared by all the keys needs no moves */
+        int b = key_byte(keys + left, depth);
+        if (count[b] < right - left)
+            break;
+        if (b == 0)
+            return; /* the keys are equal */
+
+        depth++;
+    }
+
+    int start[257];
+    for (int b = 0, s = left; b < 257; ++b) {
+        start[b] = s;
+        s += count[b];
+    }
+    for (int i = left; i < right; ++i)
+        tmp[start[key_byte(keys + i, depth)]++] = keys[i];
+    for (int i = left; i < right; ++i)
+        keys[i] = tmp[i];
+
+    /* the keys which ended (byte 0) are equal */
+    for (int b = 1, s = left + count[0]; b < 257; s += count[b++])
+        if (count[b] > 1)
+            radix(keys, tmp, s, s + count[b], depth + 1, splits + 1);
+}
+
+typedef struct {
+    Key *keys;
+    Key *tmp;
+    int left;
+    int right;
+    Mon *done;
+} Part;
+
+static void *sort_part(void *arg)
+{
+    Part *p = arg;
+    radix(p->keys, p->tmp, p->left, p->right, 0, 0);
+
+    mon_lock(p->done);
+    p->done->value++;
+    mon_signal(p->done);
+    mon_unlock(p->done);
+
+    return NULL;
+}
+
+static void sort_parallel(Key keys[], Key tmp[], int len)
+{
+    int parts = sys_cpus();
+    if (parts > MAX_PARTS)
+        parts = MAX_PARTS;
+    if (len < PARALLEL_MIN || parts < 2) {
+        radix(keys, tmp, 0, len, 0, 0);
+        return;
+    }
+
+    Mon *done = mon_new();
+    Part p[MAX_PARTS];
+    int bounds[MAX_PARTS + 1];
+    for (int i = 0; i <= parts; ++i)
+        bounds[i] = (long long) len * i / parts;
+
+    for (int i = 0; i < parts; ++i) {
+        p[i].keys = keys;
+        p[i].tmp = tmp;
+        p[i].left = bounds[i];
+        p[i].right = bounds[i + 1];
+        p[i].done = done;
+    }
+
+    /* the parts do not overlap (neither in keys nor in tmp) */
+    for (int i = 1; i < parts; ++i)
+        sys_thread(sort_part, p + i);
+    sort_part(p);
+
+    mon_lock(done);
+    while (done->value < parts)
+        mon_wait(done, -1);
+    mon_unlock(done);
+    mon_free(done);
 
-    merge(keys, tmp, pos, len, left, mid, right);
+    for (int w = 1; w < parts; w *= 2)
+        for (int i = 0; i + w < parts; i += 2 * w) {
+            int right = i + 2 * w < parts ? bounds[i + 2 * w] : len;
+            merge(keys, tmp, bounds[i], bounds[i + w], right);
+        }
+}
+
+static void sort_keys(TBuf *buf, int pos[], Type types[], int len)
+{
+    long long size = 0;
+    for (int i = 0; i < buf->len; ++i)
+        size += tuple_key_size(buf->buf[i], pos, len);
+
+    Key *keys = mem_alloc((buf->len + 1) * sizeof(Key));
+    Key *tmp = mem_alloc((buf->len + 1) * sizeof(Key));
+    unsigned char *data = mem_alloc(size + 1), *p = data;
+    for (int i = 0; i < buf->len; ++i) {
+        keys[i].t = buf->buf[i];
+        keys[i].data = p;
+        keys[i].size = tuple_key(buf->buf[i], pos, types, len, p);
+        p += keys[i].size;
+    }
+
+    sort_parallel(keys, tmp, buf->len);
+    for (int i = 0; i < buf->len; ++i)
+        buf->buf[i] = keys[i].t;
+
+    mem_free(data);
+    mem_free(tmp);
+    mem_free(keys);
 }
 
 static int find(TBuf *idx, Tuple *t, int ipos[], int tpos[], int len)
@@ -75,11 +215,33 @@ static int find(TBuf *idx, Tuple *t, int ipos[], int tpos[], int len)
     return -1;
 }
 
+extern int index_sorted(TBuf *buf, int pos[], int len)
+{
+    int res = len <= buf->olen;
+    for (int i = 0; i < len && res; ++i)
+        res = buf->order[i] == pos[i];
+
+    return res;
+}
+
 extern void index_sort(TBuf *buf, int pos[], int len)
 {
-    Tuple **tmp = mem_alloc((buf->len + 2) * sizeof(Tuple*));
-    sort(buf->buf, tmp, pos, len, 0, buf->len);
-    mem_free(tmp);
+    if (index_sorted(buf, pos, len))
+        return;
+
+    sort_keys(buf, pos, NULL, len);
+
+    buf->olen = len;
+    for (int i = 0; i < len; ++i)
+        buf->order[i] = pos[i];
+}
+
+extern void index_order(TBuf *buf, int pos[], Type types[], int len)
+{
+    sort_keys(buf, pos, types, len);
+
+    /* the order of values is not the one index_sorted stands for */
+    buf->olen = 0;
 }
 
 extern int index_has(TBuf *idx, Tuple *t, int ipos[], int tpos[], int len)
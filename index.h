@@ -1,3 +1,13 @@
+/* sorts the tuples by the attributes at pos (unless they already are) */
 extern void index_sort(TBuf *buf, int pos[], int len);
+
+/* sorts the tuples by the values of the attributes at pos (types[i] is the
+   type of the attribute at pos[i]), numbers from the smallest one */
+extern void index_order(TBuf *buf, int pos[], Type types[], int len);
+
+/* checks if the tuples are sorted by the attributes at pos (or by a longer
+   list of attributes starting with them) */
+extern int index_sorted(TBuf *buf, int pos[], int len);
+
 extern int index_has(TBuf *idx, Tuple *t, int ipos[], int tpos[], int len);
 extern TBuf *index_match(TBuf *idx, Tuple *t, int ipos[], int tpos[], int len);
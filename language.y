@@ -84,8 +84,10 @@ static void stmt_return(Rel *r);
 static L_Sum sum_create(const char *func, const char *attr, L_Expr *def);
 
 static void add_head(const char *name, Head *head);
-static void add_relvar(const char *rel, L_Attrs vars);
-static void add_relvar_inline(Head *head, L_Attrs vars);
+static void add_relvar(const char *rel, L_Attrs vars, L_Attrs index);
+static void add_relvar_inline(Head *head, L_Attrs vars, L_Attrs index);
+static void add_relvar_index(L_Attrs names, const char *word, L_Attrs index);
+static L_Attrs index_attrs(const char *word, L_Attrs attrs);
 
 static void fn_start(const char *name);
 static void fn_rel_params(L_Attrs names, Head *h);
@@ -115,7 +117,7 @@ static void fn_add();
 %token <val> TK_INT_VAL TK_LONG_VAL TK_REAL_VAL TK_STRING_VAL
 
 %type <attrs> rel_attr rel_attrs attr_names
-%type <attrs> project_attr project_attrs
+%type <attrs> project_attr project_attrs relvar_index
 %type <attrs> rename_attr rename_attrs
 %type <attrs> extend_attr extend_attrs
 %type <attrs> sum_attr sum_attrs
@@ -163,9 +165,21 @@ rel_attr:
     | attr_names TK_STRING  { $$ = attr_decl($1, String); }
     ;
 
+/* "index" is not a keyword (it stays free for any identifier), so after a
+   named type the indexed attributes are always in parentheses and the
+   type is the last of the names before "index" */
 relvar_decl:
-      TK_VAR attr_names TK_NAME ';'     { add_relvar($3, $2); }
-    | TK_VAR attr_names rel_head ';'    { add_relvar_inline($3, $2); }
+      TK_VAR attr_names TK_NAME ';'
+        { add_relvar($3, $2, attr_empty()); }
+    | TK_VAR attr_names TK_NAME '(' project_attrs ')' ';'
+        { add_relvar_index($2, $3, $5); }
+    | TK_VAR attr_names rel_head relvar_index ';'
+        { add_relvar_inline($3, $2, $4); }
+    ;
+
+relvar_index:
+      TK_NAME project_attrs     { $$ = index_attrs($1, $2); }
+    |                           { $$ = attr_empty(); }
     ;
 
 func_decl:
@@ -411,6 +425,8 @@ extern void env_free(Env *env)
     for (int i = 0; i < env->vars.len; ++i) {
         mem_free(env->vars.names[i]);
         mem_free(env->vars.heads[i]);
+        if (env->vars.indexes[i] != NULL)
+            mem_free(env->vars.indexes[i]);
     }
 
     for (int i = 0; i < env->types.len; ++i) {
@@ -445,6 +461,15 @@ extern void env_free(Env *env)
     mem_free(env);
 }
 
+extern void env_reset(Env *env)
+{
+    for (int i = 0; i < env->fns.len; ++i) {
+        Func *fn = env->fns.funcs[i];
+        for (int j = 0; j < fn->slen; ++j)
+            rel_reset(fn->stmts[j]);
+    }
+}
+
 extern Env *grammar_init()
 {
     genv = mem_alloc(sizeof(Env));
@@ -635,8 +660,16 @@ static void add_head(const char *name, Head *head)
     }
 }
 
-static void add_relvar_inline(Head *head, L_Attrs vars)
+static void add_relvar_inline(Head *head, L_Attrs vars, L_Attrs index)
 {
+    char hstr[MAX_HEAD_STR];
+    head_to_str(hstr, head);
+
+    for (int i = 0; i < index.len; ++i)
+        if (array_find(head->names, head->len, index.names[i]) < 0)
+            yyerror("unknown index attribute '%s' in %s",
+                    index.names[i], hstr);
+
     for (int i = 0; i < vars.len; ++i) {
         const char *var = vars.names[i];
         if (array_scan(genv->vars.names, genv->vars.len, var) > -1)
@@ -650,20 +683,51 @@ static void add_relvar_inline(Head *head, L_Attrs vars)
             int j = genv->vars.len++;
             genv->vars.names[j] = str_dup(var);
             genv->vars.heads[j] = head_cpy(head);
+            genv->vars.indexes[j] = NULL;
+            if (index.len > 0)
+                genv->vars.indexes[j] =
+                    head_project(head, index.names, index.len);
         }
     }
     mem_free(head);
     attr_free(vars);
+    attr_free(index);
 }
 
-static void add_relvar(const char *rel, L_Attrs vars)
+static void add_relvar(const char *rel, L_Attrs vars, L_Attrs index)
 {
     int i = array_scan(genv->types.names, genv->types.len, rel);
     if (i < 0) {
         attr_free(vars);
+        attr_free(index);
         yyerror("unknown type '%s'", rel);
     } else
-        add_relvar_inline(head_cpy(genv->types.heads[i]), vars);
+        add_relvar_inline(head_cpy(genv->types.heads[i]), vars, index);
+}
+
+static void add_relvar_index(L_Attrs names, const char *word, L_Attrs index)
+{
+    index = index_attrs(word, index);
+    if (names.len < 2) {
+        attr_free(index);
+        yyerror("missing type of variable '%s'", names.names[0]);
+    }
+
+    char rel[MAX_NAME];
+    str_cpy(rel, names.names[--names.len]);
+    mem_free(names.names[names.len]);
+
+    add_relvar(rel, names, index);
+}
+
+static L_Attrs index_attrs(const char *word, L_Attrs attrs)
+{
+    if (str_cmp(word, "index") != 0) {
+        attr_free(attrs);
+        yyerror("expected index but found '%s'", word);
+    }
+
+    return attrs;
 }
 
 static int func_param(Func *fn, char *name, int *pos, Type *type) {
@@ -834,7 +898,7 @@ static void stmt_assign(const char *var, Rel *r)
     if (idx < 0)
         gfunc->w.names[gfunc->w.len++] = str_dup(var);
 
-    gfunc->stmts[gfunc->slen++] = rel_store(var, r);
+    gfunc->stmts[gfunc->slen++] = rel_store(var, rel_optimize(r));
 }
 
 static int var_exists(const char *var)
@@ -854,7 +918,7 @@ static void stmt_temp(const char *var, Rel *r)
 
     gfunc->t.names[gfunc->t.len] = str_dup(var);
     gfunc->t.heads[gfunc->t.len++] = head_cpy(r->head);
-    gfunc->stmts[gfunc->slen++] = rel_store(var, r);
+    gfunc->stmts[gfunc->slen++] = rel_store(var, rel_optimize(r));
 }
 
 static void stmt_call(Rel *r)
@@ -869,7 +933,7 @@ static void stmt_call(Rel *r)
         str_print(var, "%d", gseq++);
         stmt_temp(var, r);
     } else
-        gfunc->stmts[gfunc->slen++] = r;
+        gfunc->stmts[gfunc->slen++] = rel_optimize(r);
 }
 
 static void stmt_return(Rel *r)
@@ -895,7 +959,7 @@ static void stmt_return(Rel *r)
                     res_str, hstr);
 
     r = rel_project(r, gfunc->ret->names, gfunc->ret->len);
-    gfunc->stmts[gfunc->slen++] = r;
+    gfunc->stmts[gfunc->slen++] = rel_optimize(r);
     gfunc_ret = 1;
 }
 
@@ -1002,7 +1066,11 @@ static Rel *r_load(const char *name)
         if (array_scan(gfunc->r.names, gfunc->r.len, name) < 0)
             gfunc->r.names[gfunc->r.len++] = str_dup(name);
 
-        res = rel_load(genv->vars.heads[i], name);
+        if (genv->vars.indexes[i] != NULL)
+            res = rel_load_indexed(genv->vars.heads[i], name,
+                                   genv->vars.indexes[i]);
+        else
+            res = rel_load(genv->vars.heads[i], name);
     } else
         yyerror("unknown variable '%s'", name);
 
@@ -19,6 +19,7 @@ limitations under the License.
 #include <string.h>
 
 #include "system.h"
+#include "memory.h"
 
 extern void *mem_alloc(long long size)
 {
@@ -59,3 +60,74 @@ extern int mem_cmp(const void *l, const void *r, long long size)
 {
     return memcmp(l, r, size);
 }
+
+/* chunks are chained through their first bytes, allocations bigger than a
+   quarter of a chunk get a chunk of their own */
+#define ARENA_CHUNK (1 << 20)
+
+typedef struct Chunk {
+    struct Chunk *next;
+    long long size;
+    long long used;
+} Chunk;
+
+struct Arena {
+    Chunk *head;
+};
+
+static Chunk *chunk_new(long long size, Chunk *next)
+{
+    Chunk *c = mem_alloc(sizeof(Chunk) + size);
+    c->next = next;
+    c->size = size;
+    c->used = 0;
+
+    return c;
+}
+
+extern Arena *arena_new()
+{
+    Arena *a = mem_alloc(sizeof(Arena));
+    a->head = chunk_new(ARENA_CHUNK, NULL);
+
+    return a;
+}
+
+extern void *arena_alloc(Arena *a, long long size)
+{
+    size = (size + 7) & ~7LL;
+
+    Chunk *c = a->head;
+    if (size > ARENA_CHUNK / 4) {
+        /* keep bumping the current chunk, the big one goes behind it */
+        c->next = chunk_new(size, c->next);
+        c = c->next;
+    } else if (c->size - c->used < size)
+        c = a->head = chunk_new(ARENA_CHUNK, c);
+
+    void *res = (char*) (c + 1) + c->used;
+    c->used += size;
+
+    return res;
+}
+
+extern void arena_reset(Arena *a)
+{
+    /* the oldest chunk is kept for the next round */
+    Chunk *c = a->head;
+    while (c->next != NULL) {
+        Chunk *next = c->next;
+        mem_free(c);
+        c = next;
+    }
+
+    c->used = 0;
+    a->head = c;
+}
+
+extern void arena_free(Arena *a)
+{
+    arena_reset(a);
+    mem_free(a->head);
+    mem_free(a);
+}
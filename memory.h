@@ -21,3 +21,11 @@ extern void mem_free(void *p);
 extern void mem_cpy(void *dest, const void *src, long long size);
 extern void mem_set(void *dest, int val, long long size);
 extern int mem_cmp(const void *l, const void *r, long long size);
+
+/* bump allocator, everything is released at once by arena_reset */
+typedef struct Arena Arena;
+
+extern Arena *arena_new();
+extern void *arena_alloc(Arena *a, long long size);
+extern void arena_reset(Arena *a);
+extern void arena_free(Arena *a);
@@ -28,6 +28,7 @@ limitations under the License.
 #include "summary.h"
 #include "variable.h"
 #include "index.h"
+#include "hash.h"
 #include "relation.h"
 #include "environment.h"
 
@@ -53,9 +54,37 @@ typedef struct {
     int ecnt;
     Expr *exprs[MAX_ATTRS];
 
-    /* unary & binary sum */
+    /* unary & binary sum (the binary one keeps the aggregates of each
+       group and the group of each tuple it summarizes per) */
     int scnt;
     Sum *sums[MAX_ATTRS];
+    Sum *groups[MAX_ATTRS];
+    int *gids;
+
+    /* pipelined evaluation state (see rel_open) */
+    Arg *arg;
+    TBuf *src;
+    int pos;
+    int done;
+    Hash *hash;
+    Tuple *pt;
+    int match;
+
+    /* batch evaluation (select, extend), the tuples are returned in the
+       order of sel */
+    Tuple **batch;
+    int *sel;
+    int blen;
+    int bpos;
+
+    /* join which orders the chain of joins below it on open */
+    int chain;
+
+    /* load: the indexed attributes, lookup: the key attribute and the
+       tuples found through the index */
+    int icnt;
+    int ipos[MAX_ATTRS];
+    TBuf *found;
 
     /* function call */
     int slen;
@@ -74,6 +103,52 @@ extern void rel_eval(Rel *r, Vars *v, Arg *a)
         tbuf_reset(r->body);
 }
 
+static int order(Rel *r, int pos[]);
+
+/* the tuples of a body which were not consumed go with it */
+static void free_body(Rel *r)
+{
+    if (r->body != NULL) {
+        Tuple *t;
+        while ((t = tbuf_next(r->body)) != NULL)
+            tuple_free(t);
+
+        tbuf_free(r->body);
+        r->body = NULL;
+    }
+}
+
+/* pipelined relations are materialized only when evaluated as a whole (a
+   relation evaluated again drops its previous body) */
+static void eval_stream(Rel *r, Vars *v, Arg *a)
+{
+    free_body(r);
+    r->body = tbuf_new();
+    r->open(r, v, a);
+
+    Tuple *t;
+    while ((t = r->next(r)) != NULL)
+        tbuf_add(r->body, t);
+
+    r->body->olen = order(r, r->body->order);
+}
+
+extern void rel_open(Rel *r, Vars *v, Arg *a)
+{
+    if (r->open != NULL)
+        r->open(r, v, a);
+    else
+        rel_eval(r, v, a);
+}
+
+extern Tuple *rel_next(Rel *r)
+{
+    if (r->next != NULL)
+        return r->next(r);
+
+    return r->body == NULL ? NULL : tbuf_next(r->body);
+}
+
 extern void rel_free(Rel *r)
 {
     r->free(r);
@@ -84,6 +159,59 @@ extern void rel_free(Rel *r)
     mem_free(r);
 }
 
+/* the tuples of a lookup which were not consumed */
+static void free_found(Ctxt *c)
+{
+    Tuple *t;
+    while ((t = tbuf_next(c->found)) != NULL)
+        tuple_free(t);
+
+    tbuf_free(c->found);
+    c->found = NULL;
+}
+
+static void free_groups(Ctxt *c)
+{
+    for (int i = 0; i < c->scnt; ++i)
+        mem_free(c->groups[i]);
+
+    mem_free(c->gids);
+    c->gids = NULL;
+}
+
+extern void rel_reset(Rel *r)
+{
+    free_body(r);
+
+    /* statements of a function call belong to the called function and are
+       reset together with it */
+    Ctxt *c = r->ctxt;
+    if (c == NULL)
+        return;
+
+    /* a pipeline which was not consumed till the end */
+    if (c->hash != NULL) {
+        hash_free(c->hash);
+        c->hash = NULL;
+    }
+    if (c->pt != NULL) {
+        tuple_free(c->pt);
+        c->pt = NULL;
+    }
+    if (c->batch != NULL)
+        while (c->bpos < c->blen)
+            tuple_free(c->batch[c->sel[c->bpos++]]);
+    if (c->found != NULL)
+        free_found(c);
+    if (c->gids != NULL)
+        free_groups(c);
+
+    if (c->left != NULL)
+        rel_reset(c->left);
+    if (c->right != NULL)
+        rel_reset(c->right);
+}
+
 static void free(Rel *r)
 {
     Ctxt *c = r->ctxt;
@@ -93,9 +221,19 @@ static void free(Rel *r)
         rel_free(c->right);
 
     for (int i = 0; i < c->ecnt; ++i)
-        expr_free(c->exprs[i]);
+        if (c->exprs[i] != NULL)
+            expr_free(c->exprs[i]);
     for (int i = 0; i < c->scnt; ++i)
         mem_free(c->sums[i]);
+
+    if (c->batch != NULL) {
+        mem_free(c->batch);
+        mem_free(c->sel);
+    }
+    if (c->found != NULL)
+        free_found(c);
+    if (c->gids != NULL)
+        free_groups(c);
 }
 
 static Rel *alloc(void (*eval)(Rel *r, Vars *s, Arg *a))
@@ -106,6 +244,8 @@ static Rel *alloc(void (*eval)(Rel *r, Vars *s, Arg *a))
     r->ctxt = r + 1;
     r->eval = eval;
     r->free = free;
+    r->open = NULL;
+    r->next = NULL;
 
     Ctxt *c = r->ctxt;
     c->left = NULL;
@@ -120,26 +260,102 @@ static Rel *alloc(void (*eval)(Rel *r, Vars *s, Arg *a))
     c->ecnt = 0;
     c->scnt = 0;
     c->slen = 0;
+    c->arg = NULL;
+    c->src = NULL;
+    c->hash = NULL;
+    c->pt = NULL;
+    c->batch = NULL;
+    c->sel = NULL;
+    c->blen = 0;
+    c->bpos = 0;
+    c->chain = 0;
+    c->icnt = 0;
+    c->found = NULL;
+    c->gids = NULL;
 
     return r;
 }
 
-static void eval_load(Rel *r, Vars *v, Arg *a)
+static Rel *alloc_stream(void (*open)(Rel *r, Vars *v, Arg *a),
+                         Tuple *(*next)(Rel *r))
+{
+    Rel *r = alloc(eval_stream);
+    r->open = open;
+    r->next = next;
+
+    return r;
+}
+
+/* streaming unary operators just pass the tuples of their input through */
+static void open_unary(Rel *r, Vars *v, Arg *a)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
+    c->arg = a;
+    rel_open(c->left, v, a);
+}
+
+static void open_batch(Rel *r, Vars *v, Arg *a)
+{
+    Ctxt *c = r->ctxt;
+    if (c->batch == NULL) {
+        c->batch = mem_alloc(sizeof(Tuple*) * MAX_BATCH);
+        c->sel = mem_alloc(sizeof(int) * MAX_BATCH);
+    }
+    c->blen = c->bpos = 0;
+    c->done = 0;
 
-    int pos = array_scan(v->names, v->len, c->name);
-    tbuf_reset(v->vals[pos]);
+    open_unary(r, v, a);
+}
 
-    Tuple *t;
-    while ((t = tbuf_next(v->vals[pos])) != NULL)
-        tbuf_add(r->body, tuple_cpy(t));
+/* pulls up to MAX_BATCH tuples of the left relation into the batch */
+static int fill(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+
+    int len = 0;
+    while (!c->done && len < MAX_BATCH) {
+        Tuple *t = rel_next(c->left);
+        if (t == NULL)
+            c->done = 1;
+        else
+            c->batch[len++] = t;
+    }
+
+    return len;
+}
+
+/* global variables are read from the volumes when they are first used */
+static TBuf *var_body(Vars *v, int idx)
+{
+    if (v->vals[idx] == NULL && v->vers[idx] > 0) {
+        v->vals[idx] = vol_read(v->vols[idx], v->names[idx], v->vers[idx]);
+        tbuf_sorted(v->vals[idx], v->stats[idx]);
+    }
+
+    return v->vals[idx];
+}
+
+static void open_load(Rel *r, Vars *v, Arg *a)
+{
+    Ctxt *c = r->ctxt;
+    c->src = var_body(v, array_scan(v->names, v->len, c->name));
+    c->pos = 0;
+}
+
+static Tuple *next_load(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    if (c->pos >= c->src->len)
+        return NULL;
+
+    /* the variable keeps its tuples, they are shared with the consumer
+       (mapped ones go away together with the mapping, so they are copied) */
+    return tuple_ref(c->src->buf[c->pos++]);
 }
 
 extern Rel *rel_load(Head *head, const char *name)
 {
-    Rel *res = alloc(eval_load);
+    Rel *res = alloc_stream(open_load, next_load);
     res->head = head_cpy(head);
 
     Ctxt *c = res->ctxt;
@@ -148,75 +364,172 @@ extern Rel *rel_load(Head *head, const char *name)
     return res;
 }
 
-static void eval_join(Rel *r, Vars *v, Arg *a)
+extern Rel *rel_load_indexed(Head *head, const char *name, Head *index)
+{
+    Rel *res = rel_load(head, name);
+
+    Ctxt *c = res->ctxt;
+    for (int i = 0; i < index->len; ++i) {
+        int pos = array_find(res->head->names, res->head->len, index->names[i]);
+        if (pos > -1)
+            c->ipos[c->icnt++] = pos;
+    }
+
+    return res;
+}
+
+/* a variable which has not been read yet is searched through the index of
+   its version or, without such an index, through the blocks its zone map
+   does not rule out. otherwise the variable is scanned. the key is the
+   only expression of an equality, a range has the lower and the upper
+   bound (either of them may be NULL). */
+static void open_lookup(Rel *r, Vars *v, Arg *a)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
+    int idx = array_scan(v->names, v->len, c->name);
+    c->done = 0;
 
-    rel_eval(c->left, v, a);
+    if (v->vals[idx] == NULL && v->vers[idx] > 0) {
+        int pos = c->ipos[0];
+        Type t = r->head->types[pos];
+
+        Value vals[2], *min = NULL, *max = NULL;
+        for (int i = 0; i < c->ecnt; ++i)
+            if (c->exprs[i] != NULL)
+                vals[i] = expr_new_val(c->exprs[i], NULL, a);
+        if (c->exprs[0] != NULL)
+            min = &vals[0];
+        if (c->ecnt == 1 || c->exprs[1] != NULL)
+            max = &vals[c->ecnt - 1];
+
+        c->found = vol_index(c->name, v->vers[idx], pos, t, min, max);
+        if (c->found == NULL)
+            c->found = vol_scan(c->name, v->vers[idx], pos, t, min, max);
+    }
+
+    if (c->found == NULL)
+        open_load(r, v, a);
+}
+
+static Tuple *next_lookup(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    if (c->found == NULL)
+        return c->done ? NULL : next_load(r);
+
+    Tuple *t = tbuf_next(c->found);
+    if (t == NULL) {
+        tbuf_free(c->found);
+        c->found = NULL;
+        c->done = 1;
+    }
+
+    return t;
+}
+
+static void order_joins(Rel *r, Vars *v);
+
+static void open_join(Rel *r, Vars *v, Arg *a)
+{
+    Ctxt *c = r->ctxt;
+    if (c->chain)
+        order_joins(r, v);
+
+    /* the right side is hashed and the left one streams through it */
     rel_eval(c->right, v, a);
+    c->hash = hash_build(c->right->body, c->e.rpos, c->e.len);
+    c->match = -1;
 
-    TBuf *lb = c->left->body;
-    index_sort(lb, c->e.lpos, c->e.len);
+    rel_open(c->left, v, a);
+}
 
-    Tuple *lt, *rt;
-    while ((rt = tbuf_next(c->right->body)) != NULL) {
-        TBuf *m = index_match(lb, rt, c->e.lpos, c->e.rpos, c->e.len);
+static Tuple *next_join(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    if (c->hash == NULL)
+        return NULL;
 
-        if (m != NULL) {
-            while ((lt = tbuf_next(m)) != NULL) {
-                Tuple *t = tuple_join(lt, rt, c->j.lpos, c->j.rpos, c->j.len);
-                tbuf_add(r->body, t);
-            }
+    while (c->match < 0) {
+        if (c->pt != NULL)
+            tuple_free(c->pt);
 
-            tbuf_free(m);
+        c->pt = rel_next(c->left);
+        if (c->pt == NULL) {
+            hash_free(c->hash);
+            c->hash = NULL;
+            tbuf_clean(c->right->body);
+
+            return NULL;
         }
 
-        tuple_free(rt);
+        c->match = hash_find(c->hash, c->pt, c->e.lpos);
     }
 
-    tbuf_clean(lb);
+    Tuple *rt = c->hash->tuples[c->match];
+    c->match = hash_next(c->hash, c->match, c->pt, c->e.lpos);
+
+    return tuple_join(c->pt, rt, c->j.lpos, c->j.rpos, c->j.len);
 }
 
-extern Rel *rel_join(Rel *l, Rel *r)
+/* (re)connects a join to its inputs */
+static void set_join(Rel *res, Rel *l, Rel *r)
 {
-    Rel *res = alloc(eval_join);
-
     Ctxt *c = res->ctxt;
+    if (res->head != NULL)
+        mem_free(res->head);
+
     res->head = head_join(l->head, r->head, c->j.lpos, c->j.rpos, &c->j.len);
     c->e.len = head_common(l->head, r->head, c->e.lpos, c->e.rpos);
     c->left = l;
     c->right = r;
+}
+
+extern Rel *rel_join(Rel *l, Rel *r)
+{
+    Rel *res = alloc_stream(open_join, next_join);
+    set_join(res, l, r);
 
     return res;
 }
 
-static void eval_union(Rel *r, Vars *v, Arg *a)
+/* union and diff hash the right side and stream the left one */
+static void open_hash(Rel *r, Vars *v, Arg *a)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
+    c->done = 0;
 
-    rel_eval(c->left, v, a);
     rel_eval(c->right, v, a);
+    c->hash = hash_build(c->right->body, c->e.rpos, c->e.len);
+
+    rel_open(c->left, v, a);
+}
 
+static Tuple *next_union(Rel *r)
+{
+    Ctxt *c = r->ctxt;
     TBuf *rb = c->right->body;
-    index_sort(rb, c->e.rpos, c->e.len);
 
-    Tuple *lt, *rt;
-    while ((lt = tbuf_next(c->left->body)) != NULL)
-        if (index_has(rb, lt, c->e.rpos, c->e.lpos, c->e.len))
-            tuple_free(lt);
-        else
-            tbuf_add(r->body, lt);
+    /* the left tuples missing on the right, then all the right ones */
+    Tuple *t;
+    if (!c->done) {
+        while ((t = rel_next(c->left)) != NULL)
+            if (hash_has(c->hash, t, c->e.lpos))
+                tuple_free(t);
+            else
+                return t;
+
+        c->done = 1;
+        hash_free(c->hash);
+        c->hash = NULL;
+        tbuf_reset(rb);
+    }
 
-    tbuf_reset(rb);
-    while ((rt = tbuf_next(rb)) != NULL)
-        tbuf_add(r->body, rt);
+    return tbuf_next(rb);
 }
 
 extern Rel *rel_union(Rel *l, Rel *r)
 {
-    Rel *res = alloc(eval_union);
+    Rel *res = alloc_stream(open_hash, next_union);
     res->head = head_cpy(l->head);
 
     Ctxt *c = res->ctxt;
@@ -227,30 +540,31 @@ extern Rel *rel_union(Rel *l, Rel *r)
     return res;
 }
 
-static void eval_diff(Rel *r, Vars *v, Arg *a)
+static Tuple *next_diff(Rel *r)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
-
-    rel_eval(c->left, v, a);
-    rel_eval(c->right, v, a);
-
     TBuf *rb = c->right->body;
-    index_sort(rb, c->e.rpos, c->e.len);
 
-    Tuple *lt;
-    while ((lt = tbuf_next(c->left->body)) != NULL)
-        if (index_has(rb, lt, c->e.rpos, c->e.lpos, c->e.len))
-            tuple_free(lt);
+    Tuple *t;
+    while (!c->done && (t = rel_next(c->left)) != NULL)
+        if (hash_has(c->hash, t, c->e.lpos))
+            tuple_free(t);
         else
-            tbuf_add(r->body, lt);
+            return t;
+
+    if (!c->done) {
+        c->done = 1;
+        hash_free(c->hash);
+        c->hash = NULL;
+        tbuf_clean(rb);
+    }
 
-    tbuf_clean(rb);
+    return NULL;
 }
 
 extern Rel *rel_diff(Rel *l, Rel *r)
 {
-    Rel *res = alloc(eval_diff);
+    Rel *res = alloc_stream(open_hash, next_diff);
     res->head = head_cpy(l->head);
 
     Ctxt *c = res->ctxt;
@@ -261,21 +575,51 @@ extern Rel *rel_diff(Rel *l, Rel *r)
     return res;
 }
 
+/* an input sorted by the projected attributes has its duplicates next to
+   each other, otherwise they are found through a hash of the result */
 static void eval_project(Rel *r, Vars *v, Arg *a)
 {
     Ctxt *c = r->ctxt;
+    free_body(r);
     r->body = tbuf_new();
 
-    rel_eval(c->left, v, a);
-    index_sort(c->left->body, c->e.lpos, c->e.len);
+    rel_open(c->left, v, a);
 
-    Tuple *t;
-    while ((t = tbuf_next(c->left->body)) != NULL) {
-        if (!index_has(r->body, t, c->e.rpos, c->e.lpos, c->e.len))
-            tbuf_add(r->body, tuple_reord(t, c->e.lpos, c->e.len));
+    /* the input is streamed, only the distinct tuples are kept */
+    int opos[MAX_ATTRS], olen = order(c->left, opos);
+    int sorted = c->e.len <= olen;
+    for (int i = 0; i < c->e.len && sorted; ++i)
+        sorted = opos[i] == c->e.lpos[i];
+
+    Hash *seen = sorted ? NULL : hash_new(c->e.rpos, c->e.len, 0);
+
+    Tuple *t, *last = NULL;
+    while ((t = rel_next(c->left)) != NULL) {
+        int dup = 0;
+        if (sorted)
+            dup = last != NULL &&
+                  tuple_cmp(last, t, c->e.rpos, c->e.lpos, c->e.len) == 0;
+        else
+            dup = hash_has(seen, t, c->e.lpos);
+
+        if (!dup) {
+            last = tuple_reord(t, c->e.lpos, c->e.len);
+            tbuf_add(r->body, last);
+            if (seen != NULL)
+                hash_add(seen, last);
+        }
 
         tuple_free(t);
     }
+
+    if (seen != NULL)
+        hash_free(seen);
+
+    if (sorted) {
+        r->body->olen = c->e.len;
+        for (int i = 0; i < c->e.len; ++i)
+            r->body->order[i] = c->e.rpos[i];
+    }
 }
 
 extern Rel *rel_project(Rel *r, char *names[], int len)
@@ -290,23 +634,21 @@ extern Rel *rel_project(Rel *r, char *names[], int len)
     return res;
 }
 
-static void eval_rename(Rel *r, Vars *v, Arg *a)
+static Tuple *next_rename(Rel *r)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
-
-    rel_eval(c->left, v, a);
-
-    Tuple *t;
-    while ((t = tbuf_next(c->left->body)) != NULL) {
-        tbuf_add(r->body, tuple_reord(t, c->apos, c->acnt));
+    Tuple *res = NULL, *t = rel_next(c->left);
+    if (t != NULL) {
+        res = tuple_reord(t, c->apos, c->acnt);
         tuple_free(t);
     }
+
+    return res;
 }
 
 extern Rel *rel_rename(Rel *r, char *from[], char *to[], int len)
 {
-    Rel *res = alloc(eval_rename);
+    Rel *res = alloc_stream(open_unary, next_rename);
 
     Ctxt *c = res->ctxt;
     res->head = head_rename(r->head, from, to, len, c->apos, &c->acnt);
@@ -315,24 +657,31 @@ extern Rel *rel_rename(Rel *r, char *from[], char *to[], int len)
     return res;
 }
 
-static void eval_select(Rel *r, Vars *v, Arg *a)
+static Tuple *next_select(Rel *r)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
 
-    rel_eval(c->left, v, a);
+    while (c->bpos == c->blen) {
+        int len = fill(r);
+        if (len == 0)
+            return NULL;
 
-    Tuple *t;
-    while ((t = tbuf_next(c->left->body)) != NULL)
-        if (expr_bool_val(c->exprs[0], t, a))
-            tbuf_add(r->body, t);
-        else
-            tuple_free(t);
+        c->bpos = 0;
+        c->blen = expr_batch_sel(c->exprs[0], c->batch, len, c->arg, c->sel);
+
+        for (int i = 0, j = 0; i < len; ++i)
+            if (j < c->blen && c->sel[j] == i)
+                j++;
+            else
+                tuple_free(c->batch[i]);
+    }
+
+    return c->batch[c->sel[c->bpos++]];
 }
 
 extern Rel *rel_select(Rel *r, Expr *bool_expr)
 {
-    Rel *res = alloc(eval_select);
+    Rel *res = alloc_stream(open_batch, next_select);
     res->head = head_cpy(r->head);
 
     Ctxt *c = res->ctxt;
@@ -343,31 +692,43 @@ extern Rel *rel_select(Rel *r, Expr *bool_expr)
     return res;
 }
 
-static void eval_extend(Rel *r, Vars *v, Arg *a)
+static Tuple *next_extend(Rel *r)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
 
-    rel_eval(c->left, v, a);
+    if (c->bpos == c->blen) {
+        int len = fill(r);
+        if (len == 0)
+            return NULL;
 
-    Tuple *t;
-    while ((t = tbuf_next(c->left->body)) != NULL) {
-        Value vals[c->ecnt];
         for (int i = 0; i < c->ecnt; ++i)
-            vals[i] = expr_new_val(c->exprs[i], t, a);
+            expr_batch(c->exprs[i], c->batch, len, c->arg);
+
+        /* the extended tuples replace the original ones in the batch */
+        Value vals[c->ecnt];
+        for (int k = 0; k < len; ++k) {
+            for (int i = 0; i < c->ecnt; ++i)
+                vals[i] = expr_batch_val(c->exprs[i], k);
 
-        Tuple *e = tuple_new(vals, c->ecnt);
-        Tuple *res = tuple_join(t, e, c->j.lpos, c->j.rpos, c->j.len);
-        tbuf_add(r->body, res);
+            Tuple *t = c->batch[k];
+            Tuple *e = tuple_new(vals, c->ecnt);
+            c->batch[k] = tuple_join(t, e, c->j.lpos, c->j.rpos, c->j.len);
+            c->sel[k] = k;
 
-        tuple_free(e);
-        tuple_free(t);
+            tuple_free(e);
+            tuple_free(t);
+        }
+
+        c->bpos = 0;
+        c->blen = len;
     }
+
+    return c->batch[c->sel[c->bpos++]];
 }
 
 extern Rel *rel_extend(Rel *r, char *names[], Expr *e[], int len)
 {
-    Rel *res = alloc(eval_extend);
+    Rel *res = alloc_stream(open_batch, next_extend);
     Ctxt *c = res->ctxt;
     c->left = r;
     c->ecnt = len;
@@ -386,47 +747,100 @@ extern Rel *rel_extend(Rel *r, char *names[], Expr *e[], int len)
     return res;
 }
 
-static void eval_sum(Rel *r, Vars *v, Arg *a)
+/* the groups are hashed and the summarized relation streams through them
+   once, updating the aggregates of its group */
+static void open_sum(Rel *r, Vars *v, Arg *a)
 {
     Ctxt *c = r->ctxt;
-    r->body = tbuf_new();
-
-    rel_eval(c->left, v, a);
     rel_eval(c->right, v, a);
 
-    int scnt = c->scnt;
-
-    TBuf *lb = c->left->body;
-    index_sort(lb, c->e.lpos, c->e.len);
+    /* the tuples with the same common attributes share a group */
+    TBuf *rb = c->right->body;
+    c->hash = hash_new(c->e.rpos, c->e.len, rb->len);
+    c->gids = mem_alloc(sizeof(int) * (rb->len + 1));
+    for (int i = 0; i < rb->len; ++i) {
+        c->gids[i] = hash_find(c->hash, rb->buf[i], c->e.rpos);
+        if (c->gids[i] < 0) {
+            c->gids[i] = c->hash->len;
+            hash_add(c->hash, rb->buf[i]);
+        }
+    }
 
-    Tuple *lt, *rt;
-    while ((rt = tbuf_next(c->right->body)) != NULL) {
-        for (int i = 0; i < scnt; ++i)
-            sum_reset(c->sums[i]);
+    for (int i = 0; i < c->scnt; ++i)
+        c->groups[i] = sum_groups(c->sums[i], c->hash->len);
+
+    rel_open(c->left, v, a);
+
+    /* the tuples of a batch are chained by group (first[g] and next), so
+       each group seen in the batch is summarized with one sum_batch call */
+    int *first = mem_alloc(sizeof(int) * (c->hash->len + 1));
+    for (int g = 0; g < c->hash->len; ++g)
+        first[g] = -1;
+
+    Tuple *ts[MAX_BATCH], *grp[MAX_BATCH];
+    int next[MAX_BATCH], seen[MAX_BATCH], len;
+    do {
+        int scnt = 0;
+        for (len = 0; len < MAX_BATCH; ++len) {
+            if ((ts[len] = rel_next(c->left)) == NULL)
+                break;
+
+            int g = hash_find(c->hash, ts[len], c->e.lpos);
+            if (g < 0)
+                continue;
+            if (first[g] < 0)
+                seen[scnt++] = g;
+
+            next[len] = first[g];
+            first[g] = len;
+        }
 
-        TBuf *m = index_match(lb, rt, c->e.lpos, c->e.rpos, c->e.len);
-        if (m != NULL) {
-            while ((lt = tbuf_next(m)) != NULL)
-                for (int i = 0; i < scnt; ++i)
-                    sum_update(c->sums[i], lt);
+        for (int j = 0; j < scnt; ++j) {
+            int g = seen[j], glen = 0;
+            for (int k = first[g]; k > -1; k = next[k])
+                grp[glen++] = ts[k];
+            first[g] = -1;
 
-            tbuf_free(m);
+            for (int i = 0; i < c->scnt; ++i)
+                sum_batch(sum_group(c->groups[i], g), grp, glen);
         }
 
-        Value vals[scnt];
-        for (int i = 0; i < scnt; ++i)
-            vals[i] = sum_value(c->sums[i]);
+        for (int i = 0; i < len; ++i)
+            tuple_free(ts[i]);
+    } while (len == MAX_BATCH);
 
-        Tuple *st = tuple_new(vals, scnt);
-        Tuple *res = tuple_join(rt, st, c->j.lpos, c->j.rpos, c->j.len);
+    mem_free(first);
+    hash_free(c->hash);
+    c->hash = NULL;
+}
+
+static Tuple *next_sum(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    TBuf *rb = c->right->body;
+    int scnt = c->scnt;
 
-        tbuf_add(r->body, res);
+    Tuple *rt = c->gids == NULL ? NULL : tbuf_next(rb);
+    if (rt == NULL) {
+        if (c->gids != NULL)
+            free_groups(c);
 
-        tuple_free(st);
-        tuple_free(rt);
+        return NULL;
     }
 
-    tbuf_clean(lb);
+    /* groups without any tuples have the default values */
+    int g = c->gids[rb->pos - 1];
+    Value vals[scnt];
+    for (int i = 0; i < scnt; ++i)
+        vals[i] = sum_value(sum_group(c->groups[i], g));
+
+    Tuple *st = tuple_new(vals, scnt);
+    Tuple *res = tuple_join(rt, st, c->j.lpos, c->j.rpos, c->j.len);
+
+    tuple_free(st);
+    tuple_free(rt);
+
+    return res;
 }
 
 extern Rel *rel_sum(Rel *r,
@@ -436,7 +850,7 @@ extern Rel *rel_sum(Rel *r,
                     Sum *sums[],
                     int len)
 {
-    Rel *res = alloc(eval_sum);
+    Rel *res = alloc_stream(open_sum, next_sum);
 
     Ctxt *c = res->ctxt;
     c->e.len = head_common(r->head, per->head, c->e.lpos, c->e.rpos);
@@ -462,20 +876,26 @@ extern Rel *rel_sum(Rel *r,
 static void eval_sum_unary(Rel *r, Vars *v, Arg *a)
 {
     Ctxt *c = r->ctxt;
+    free_body(r);
     r->body = tbuf_new();
 
-    rel_eval(c->left, v, a);
+    rel_open(c->left, v, a);
 
     for (int i = 0; i < c->scnt; ++i)
         sum_reset(c->sums[i]);
 
-    Tuple *t;
-    while ((t = tbuf_next(c->left->body)) != NULL) {
-        for (int i = 0; i < c->scnt; ++i)
-            sum_update(c->sums[i], t);
+    Tuple *ts[MAX_BATCH];
+    int len;
+    do {
+        for (len = 0; len < MAX_BATCH; ++len)
+            if ((ts[len] = rel_next(c->left)) == NULL)
+                break;
 
-        tuple_free(t);
-    }
+        for (int i = 0; i < c->scnt; ++i)
+            sum_batch(c->sums[i], ts, len);
+        for (int i = 0; i < len; ++i)
+            tuple_free(ts[i]);
+    } while (len == MAX_BATCH);
 
     Value vals[c->scnt];
     for (int i = 0; i < c->scnt; ++i)
@@ -534,6 +954,54 @@ extern Rel *rel_store(const char *name, Rel *r)
     return res;
 }
 
+/* translates the order of an input into the positions of the result, map
+   holds the input position of each result attribute */
+static int map_order(int in[], int ilen, int map[], int mlen, int pos[])
+{
+    int len = 0;
+    for (; len < ilen; ++len) {
+        int p = -1;
+        for (int i = 0; i < mlen && p < 0; ++i)
+            if (map[i] == in[len])
+                p = i;
+
+        if (p < 0)
+            break;
+
+        pos[len] = p;
+    }
+
+    return len;
+}
+
+/* the attribute positions the tuples of a relation come sorted by (see
+   TBuf.order), the streams keep the order of their (left) input */
+static int order(Rel *r, int pos[])
+{
+    Ctxt *c = r->ctxt;
+    TBuf *b = r->next == next_load ? c->src : r->body;
+    int in[MAX_ATTRS], len = 0;
+
+    if (r->next == NULL || r->next == next_load) {
+        if (b != NULL)
+            for (; len < b->olen; ++len)
+                pos[len] = b->order[len];
+    } else if (r->next == next_select || r->next == next_diff) {
+        len = order(c->left, pos);
+    } else if (r->next == next_rename) {
+        len = order(c->left, in);
+        len = map_order(in, len, c->apos, c->acnt, pos);
+    } else if (r->next == next_extend || r->next == next_join) {
+        len = order(c->left, in);
+        len = map_order(in, len, c->j.lpos, c->j.len, pos);
+    } else if (r->next == next_sum) {
+        len = order(c->right, in);
+        len = map_order(in, len, c->j.lpos, c->j.len, pos);
+    }
+
+    return len;
+}
+
 extern int rel_eq(Rel *l, Rel *r)
 {
     if (!head_eq(l->head, r->head))
@@ -543,14 +1011,15 @@ extern int rel_eq(Rel *l, Rel *r)
     int lpos[MAX_ATTRS], rpos[MAX_ATTRS];
     int len = head_common(l->head, r->head, lpos, rpos);
 
-    index_sort(l->body, lpos, len);
+    Hash *h = hash_build(l->body, lpos, len);
 
     Tuple *rt;
     while (all_ok && (rt = tbuf_next(r->body)) != NULL) {
-        all_ok = all_ok && index_has(l->body, rt, lpos, rpos, len);
+        all_ok = all_ok && hash_has(h, rt, rpos);
         tuple_free(rt);
         rcnt++;
     }
+    hash_free(h);
 
     all_ok = all_ok && (l->body->len == rcnt);
 
@@ -570,7 +1039,9 @@ static void vars_move(Vars *dest, Vars *src, char **names, int len)
 
         if (src != NULL) {
             int src_pos = array_scan(src->names, src->len, names[i]);
-            vars_add(dest, names[i], 0, src->vals[src_pos]);
+            vars_add(dest, names[i], src->vers[src_pos], src->vals[src_pos]);
+            str_cpy(dest->vols[dest->len - 1], src->vols[src_pos]);
+            vars_stats(dest, dest->len - 1, src->stats[src_pos]);
             src->vals[src_pos] = NULL;
         } else
             vars_add(dest, names[i], 0, NULL);
@@ -610,16 +1081,11 @@ static void eval_call(Rel *r, Vars *v, Arg *a)
     for (int i = 0; i < c->slen; ++i)
         rel_eval(c->stmts[i], nv, na);
 
-    /* copy the return value (if any) */
+    /* share the return value (if any) */
     if (r->head != NULL) {
-        r->body = tbuf_new();
-
         TBuf *ret = c->stmts[c->slen - 1]->body;
-
-        Tuple *t;
-        tbuf_reset(ret);
-        while ((t = tbuf_next(ret)) != NULL)
-            tbuf_add(r->body, tuple_cpy(t));
+        free_body(r);
+        r->body = tbuf_share(ret);
         tbuf_reset(ret);
     }
 
@@ -689,3 +1155,515 @@ extern Rel *rel_call(char **r, int rlen,
 
     return res;
 }
+
+/* checks that the attributes of h marked in used are all in child, map
+   receives their positions in child */
+static int attrs_in(Head *h, Head *child, int used[], int map[])
+{
+    for (int i = 0; i < h->len; ++i) {
+        Type t;
+        map[i] = -1;
+        if (used[i] && !head_attr(child, h->names[i], &map[i], &t))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* frees an operator without its inputs and expressions */
+static void drop(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    c->left = NULL;
+    c->right = NULL;
+    c->ecnt = 0;
+
+    rel_free(r);
+}
+
+static Rel *push_select(Rel *r);
+
+static Rel *select_below(Rel *in, Expr *e, int map[])
+{
+    expr_remap(e, map);
+    return push_select(rel_select(in, e));
+}
+
+/* adjacent selects which cannot be pushed any further are merged */
+static Rel *merge_select(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    Rel *in = c->left;
+    if (in->next != next_select)
+        return r;
+
+    Ctxt *ic = in->ctxt;
+    c->exprs[0] = expr_and(ic->exprs[0], c->exprs[0]);
+    c->left = ic->left;
+    drop(in);
+
+    return r;
+}
+
+static Rel *push_select(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    Rel *in = c->left;
+    Ctxt *ic = in->ctxt;
+    Expr *e = c->exprs[0];
+
+    int used[MAX_ATTRS], map[MAX_ATTRS];
+    for (int i = 0; i < MAX_ATTRS; ++i)
+        used[i] = 0;
+    expr_attrs(e, used);
+
+    if (ic == NULL)
+        return r;
+
+    if (in->next == next_select) {
+        c->left = ic->left;
+        ic->left = push_select(r);
+        return merge_select(in);
+    } else if (in->next == next_join) {
+        int rmap[MAX_ATTRS];
+        int to_l = attrs_in(in->head, ic->left->head, used, map);
+        int to_r = attrs_in(in->head, ic->right->head, used, rmap);
+        if (!to_l && !to_r)
+            return r;
+
+        /* predicates on the common attributes filter both sides */
+        if (to_r)
+            ic->right = select_below(ic->right, to_l ? expr_cpy(e) : e, rmap);
+        if (to_l)
+            ic->left = select_below(ic->left, e, map);
+    } else if (in->next == next_union) {
+        attrs_in(in->head, ic->right->head, used, map);
+        ic->right = select_below(ic->right, expr_cpy(e), map);
+        attrs_in(in->head, ic->left->head, used, map);
+        ic->left = select_below(ic->left, e, map);
+    } else if (in->next == next_diff) {
+        attrs_in(in->head, ic->left->head, used, map);
+        ic->left = select_below(ic->left, e, map);
+    } else if (in->next == next_rename) {
+        for (int i = 0; i < ic->acnt; ++i)
+            map[i] = ic->apos[i];
+        ic->left = select_below(ic->left, e, map);
+    } else if (in->next == next_extend) {
+        if (!attrs_in(in->head, ic->left->head, used, map))
+            return r;
+        ic->left = select_below(ic->left, e, map);
+    } else
+        return r;
+
+    drop(r);
+    return in;
+}
+
+static Rel *push_project(Rel *r);
+
+/* projection of r to the attributes of h and of keep */
+static Rel *project_below(Rel *r, Head *h, Head *keep)
+{
+    int len = 0;
+    char *names[MAX_ATTRS];
+    for (int i = 0; i < r->head->len; ++i)
+        if (head_find(h, r->head->names[i]) ||
+            (keep != NULL && head_find(keep, r->head->names[i])))
+            names[len++] = r->head->names[i];
+
+    if (len == r->head->len)
+        return r;
+
+    return push_project(rel_project(r, names, len));
+}
+
+/* the project of r to its own attributes over a new input */
+static Rel *reproject(Rel *r, Rel *in)
+{
+    Rel *res = in;
+    if (!head_eq(r->head, in->head))
+        res = rel_project(in, r->head->names, r->head->len);
+
+    drop(r);
+    return res;
+}
+
+static Rel *push_project(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    Rel *in = c->left;
+    Ctxt *ic = in->ctxt;
+    if (ic == NULL)
+        return r;
+
+    if (in->eval == eval_project) {
+        Rel *res = rel_project(ic->left, r->head->names, r->head->len);
+        drop(in);
+        drop(r);
+
+        return push_project(res);
+    } else if (in->next == next_join) {
+        /* the join attributes stay on both sides */
+        Rel *l = project_below(ic->left, r->head, ic->right->head);
+        Rel *rr = project_below(ic->right, r->head, ic->left->head);
+        if (l == ic->left && rr == ic->right)
+            return r;
+
+        drop(in);
+        return reproject(r, rel_join(l, rr));
+    } else if (in->next == next_union) {
+        Rel *l = project_below(ic->left, r->head, NULL);
+        Rel *rr = project_below(ic->right, r->head, NULL);
+
+        drop(in);
+        return reproject(r, rel_union(l, rr));
+    } else if (in->next == next_select) {
+        int used[MAX_ATTRS], map[MAX_ATTRS];
+        for (int i = 0; i < MAX_ATTRS; ++i)
+            used[i] = 0;
+        expr_attrs(ic->exprs[0], used);
+
+        char *names[MAX_ATTRS];
+        int len = 0;
+        for (int i = 0; i < in->head->len; ++i)
+            if (used[i])
+                names[len++] = in->head->names[i];
+
+        Head *h = head_project(in->head, names, len);
+        Rel *p = project_below(ic->left, r->head, h);
+        mem_free(h);
+        if (p == ic->left)
+            return r;
+
+        Expr *e = ic->exprs[0];
+        attrs_in(in->head, p->head, used, map);
+        expr_remap(e, map);
+        drop(in);
+
+        return reproject(r, rel_select(p, e));
+    }
+
+    return r;
+}
+
+static Rel *rewrite(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    if (c == NULL)
+        return r;
+
+    if (c->left != NULL)
+        c->left = rewrite(c->left);
+    if (c->right != NULL)
+        c->right = rewrite(c->right);
+
+    if (r->next == next_select)
+        return push_select(r);
+    if (r->eval == eval_project)
+        return push_project(r);
+
+    return r;
+}
+
+/* only the topmost join of a chain orders it */
+static void mark_joins(Rel *r, int inner)
+{
+    Ctxt *c = r->ctxt;
+    if (c == NULL)
+        return;
+
+    int join = r->next == next_join;
+    if (join)
+        c->chain = !inner;
+
+    if (c->left != NULL)
+        mark_joins(c->left, join);
+    if (c->right != NULL)
+        mark_joins(c->right, join);
+}
+
+/* a select over a variable looks the tuples up by the key or the range it
+   compares one of the attributes with (the select stays as it is) */
+static void use_index(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    Rel *in = c->left;
+    if (in->next != next_load)
+        return;
+
+    /* the indexed attributes go first */
+    Ctxt *ic = in->ctxt;
+    Expr *min = NULL, *max = NULL;
+    int pos = -1, found = 0;
+    for (int i = 0; i < ic->icnt && !found; ++i) {
+        pos = ic->ipos[i];
+        found = expr_range(c->exprs[0], &pos, &min, &max);
+    }
+    if (!found) {
+        pos = -1;
+        found = expr_range(c->exprs[0], &pos, &min, &max);
+    }
+
+    if (!found)
+        return;
+
+    Rel *res = alloc_stream(open_lookup, next_lookup);
+    res->head = head_cpy(in->head);
+
+    Ctxt *rc = res->ctxt;
+    str_cpy(rc->name, ic->name);
+    rc->icnt = 1;
+    rc->ipos[0] = pos;
+    if (min == max) {
+        rc->ecnt = 1;
+        rc->exprs[0] = expr_cpy(min);
+    } else {
+        rc->ecnt = 2;
+        rc->exprs[0] = min == NULL ? NULL : expr_cpy(min);
+        rc->exprs[1] = max == NULL ? NULL : expr_cpy(max);
+    }
+
+    c->left = res;
+    rel_free(in);
+}
+
+static void lookups(Rel *r)
+{
+    Ctxt *c = r->ctxt;
+    if (c == NULL)
+        return;
+
+    if (r->next == next_select)
+        use_index(r);
+
+    if (c->left != NULL)
+        lookups(c->left);
+    if (c->right != NULL)
+        lookups(c->right);
+}
+
+extern Rel *rel_optimize(Rel *r)
+{
+    r = rewrite(r);
+    mark_joins(r, 0);
+    lookups(r);
+
+    return r;
+}
+
+/* size of relations without anything better to go by */
+#define GUESS 1000.0
+
+/* estimated number of tuples of a relation and of distinct values of each
+   of its attributes */
+typedef struct {
+    Head *head;
+    double len;
+    double d[MAX_ATTRS];
+} Est;
+
+/* a common attribute reduces the cross product by the larger number of its
+   distinct values, returns the number of common attributes */
+static int est_join(Est *res, Est *l, Est *r)
+{
+    int lpos[MAX_ATTRS], rpos[MAX_ATTRS], len;
+    res->head = head_join(l->head, r->head, lpos, rpos, &len);
+
+    int clen = head_common(l->head, r->head, lpos, rpos);
+    res->len = l->len * r->len;
+    for (int i = 0; i < clen; ++i)
+        res->len /= l->d[lpos[i]] > r->d[rpos[i]] ? l->d[lpos[i]]
+                                                  : r->d[rpos[i]];
+    if (res->len < 1)
+        res->len = 1;
+
+    for (int i = 0; i < len; ++i) {
+        int p;
+        Type t;
+        res->d[i] = res->len;
+        if (head_attr(l->head, res->head->names[i], &p, &t) &&
+            l->d[p] < res->d[i])
+            res->d[i] = l->d[p];
+        if (head_attr(r->head, res->head->names[i], &p, &t) &&
+            r->d[p] < res->d[i])
+            res->d[i] = r->d[p];
+    }
+
+    return clen;
+}
+
+/* the loaded variables are counted, the statistics of the stored versions
+   (if any) give the distinct values, a select is assumed to keep a third of
+   its input */
+static void estimate(Est *res, Rel *r, Vars *v)
+{
+    Ctxt *c = r->ctxt;
+    res->head = head_cpy(r->head);
+    res->len = GUESS;
+    for (int i = 0; i < r->head->len; ++i)
+        res->d[i] = -1;
+
+    if (r->next == next_load || r->next == next_lookup) {
+        int idx = array_scan(v->names, v->len, c->name);
+        Stats *s = idx < 0 ? NULL : v->stats[idx];
+        if (idx > -1 && v->vals[idx] != NULL)
+            res->len = v->vals[idx]->len;
+        else if (s != NULL)
+            res->len = s->len;
+        if (s != NULL && s->attrs == r->head->len)
+            for (int i = 0; i < s->attrs; ++i)
+                res->d[i] = s->vals[i].distinct;
+
+        /* each key value is assumed to be equally frequent, a range is
+           assumed to keep a third like a select */
+        if (r->next == next_lookup && c->ecnt == 1)
+            res->len /= res->d[c->ipos[0]] > 0 ? res->d[c->ipos[0]] : 3;
+        else if (r->next == next_lookup)
+            res->len /= 3;
+    } else if (r->next == next_join) {
+        Est l, rr;
+        estimate(&l, c->left, v);
+        estimate(&rr, c->right, v);
+
+        mem_free(res->head);
+        est_join(res, &l, &rr);
+        mem_free(l.head);
+        mem_free(rr.head);
+    } else if (r->next == next_select || r->next == next_rename ||
+               r->next == next_extend || r->eval == eval_project) {
+        Est in;
+        estimate(&in, c->left, v);
+
+        res->len = in.len;
+        if (r->next == next_select)
+            res->len /= 3;
+
+        for (int i = 0; i < r->head->len; ++i) {
+            int p;
+            Type t;
+            if (r->next == next_rename)
+                p = c->apos[i];
+            else if (r->next == next_extend)
+                p = c->j.lpos[i];
+            else if (!head_attr(in.head, r->head->names[i], &p, &t))
+                p = -1;
+
+            if (p > -1)
+                res->d[i] = in.d[p];
+        }
+        mem_free(in.head);
+    }
+
+    if (res->len < 1)
+        res->len = 1;
+    for (int i = 0; i < r->head->len; ++i) {
+        if (res->d[i] < 0 || res->d[i] > res->len)
+            res->d[i] = res->len;
+        if (res->d[i] < 1)
+            res->d[i] = 1;
+    }
+}
+
+static int chain_len(Rel *r, int root)
+{
+    Ctxt *c = r->ctxt;
+    if (r->next != next_join || (!root && c->chain))
+        return 1;
+
+    return chain_len(c->left, 0) + chain_len(c->right, 0);
+}
+
+/* collects the inputs of a join chain (in the source order) and its joins
+   (the topmost first) */
+static void chain(Rel *r, Rel *ins[], int *ilen, Rel *joins[], int *jlen)
+{
+    Ctxt *c = r->ctxt;
+    if (r->next != next_join || (*jlen > 0 && c->chain)) {
+        ins[(*ilen)++] = r;
+        return;
+    }
+
+    joins[(*jlen)++] = r;
+    chain(c->left, ins, ilen, joins, jlen);
+    chain(c->right, ins, ilen, joins, jlen);
+}
+
+static int cheaper(int conn, double len, int best_conn, double best_len)
+{
+    return conn > best_conn || (conn == best_conn && len < best_len);
+}
+
+/* rebuilds a chain of natural joins (left-deep) starting with the pair of
+   inputs which gives the smallest result and then adding the input which
+   keeps the intermediate result the smallest. inputs without common
+   attributes come last. the smaller side of each join is hashed */
+static void order_joins(Rel *r, Vars *v)
+{
+    int n = chain_len(r, 1);
+    Rel *ins[n], *joins[n - 1];
+    int ilen = 0, jlen = 0;
+    chain(r, ins, &ilen, joins, &jlen);
+
+    Est est[n], cur, next;
+    int done[n];
+    for (int i = 0; i < n; ++i) {
+        estimate(&est[i], ins[i], v);
+        done[i] = 0;
+    }
+
+    int first = 0, second = 1, best_conn = -1;
+    double best_len = 0;
+    for (int i = 0; i < n; ++i)
+        for (int j = i + 1; j < n; ++j) {
+            int conn = est_join(&next, &est[i], &est[j]) > 0;
+            if (cheaper(conn, next.len, best_conn, best_len)) {
+                first = i;
+                second = j;
+                best_conn = conn;
+                best_len = next.len;
+            }
+            mem_free(next.head);
+        }
+
+    Rel *prev = joins[n - 2];
+    if (est[first].len < est[second].len)
+        set_join(prev, ins[second], ins[first]);
+    else
+        set_join(prev, ins[first], ins[second]);
+
+    est_join(&cur, &est[first], &est[second]);
+    done[first] = done[second] = 1;
+
+    for (int s = 2; s < n; ++s) {
+        int k = -1;
+        best_conn = -1;
+        for (int i = 0; i < n; ++i) {
+            if (done[i])
+                continue;
+
+            int conn = est_join(&next, &cur, &est[i]) > 0;
+            if (cheaper(conn, next.len, best_conn, best_len)) {
+                k = i;
+                best_conn = conn;
+                best_len = next.len;
+            }
+            mem_free(next.head);
+        }
+
+        Rel *j = joins[n - 1 - s];
+        if (cur.len < est[k].len)
+            set_join(j, ins[k], prev);
+        else
+            set_join(j, prev, ins[k]);
+
+        est_join(&next, &cur, &est[k]);
+        mem_free(cur.head);
+        cur = next;
+        done[k] = 1;
+        prev = j;
+    }
+
+    mem_free(cur.head);
+    for (int i = 0; i < n; ++i)
+        mem_free(est[i].head);
+}
@@ -22,6 +22,10 @@ struct Rel {
 
     void (*eval)(struct Rel *r, Vars *v, Arg *a);
     void (*free)(struct Rel *r);
+
+    /* pipelined evaluation (NULL if the relation is always materialized) */
+    void (*open)(struct Rel *r, Vars *v, Arg *a);
+    Tuple *(*next)(struct Rel *r);
 };
 
 typedef struct Rel Rel;
@@ -29,9 +33,25 @@ typedef struct Rel Rel;
 /* evaluate a relation with the corresponding arguments */
 extern void rel_eval(Rel *r, Vars *v, Arg *a);
 
+/* pipelined evaluation: rel_open prepares the relation and rel_next returns
+   its tuples one by one (the caller owns them) or NULL after the last one.
+   only the inputs which have to be indexed are materialized */
+extern void rel_open(Rel *r, Vars *v, Arg *a);
+extern Tuple *rel_next(Rel *r);
+
+/* rewrite a relation tree into an equivalent one: selects are pushed
+   towards the loads (and merged when they cannot go any further) and
+   projections drop the unused attributes before the joins. chains of joins
+   are reordered by their estimated sizes each time they are opened */
+extern Rel *rel_optimize(Rel *r);
+
 /* free a relation */
 extern void rel_free(Rel *r);
 
+/* release the evaluation results (unconsumed bodies) of a relation tree so
+   the same relation can be evaluated again */
+extern void rel_reset(Rel *r);
+
 /* check if two relations are identical (relations must be evaluated first) */
 extern int rel_eq(Rel *l, Rel *r);
 
@@ -40,6 +60,11 @@ extern int rel_eq(Rel *l, Rel *r);
    passed to functions */
 extern Rel *rel_load(Head *head, const char *name);
 
+/* load a global variable which has an index on the attributes of index.
+   rel_optimize turns the selects comparing an indexed attribute with a key
+   into lookups of the key */
+extern Rel *rel_load_indexed(Head *head, const char *name, Head *index);
+
 /* store a relation in a variable identified by name */
 extern Rel *rel_store(const char *name, Rel *r);
 
@@ -22,10 +22,12 @@ limitations under the License.
 #include "head.h"
 #include "value.h"
 #include "tuple.h"
+#include "number.h"
 #include "summary.h"
 
 static Sum *alloc(int size, int pos, Type t, Value def) {
     Sum *res = mem_alloc(size);
+    res->size = size;
     res->type = t;
     res->pos = pos;
     res->ctxt = res + 1;
@@ -42,6 +44,20 @@ static Sum *alloc(int size, int pos, Type t, Value def) {
     return res;
 }
 
+/* calls fn with the attribute data of up to MAX_BATCH tuples at a time */
+static void chunks(Sum *s,
+                   Tuple *ts[],
+                   int len,
+                   void (*fn)(Sum *s, void *data[], int len))
+{
+    void *data[MAX_BATCH];
+    for (int i = 0; i < len; i += MAX_BATCH) {
+        int n = len - i < MAX_BATCH ? len - i : MAX_BATCH;
+        tuple_attrs(ts + i, n, s->pos, data);
+        fn(s, data, n);
+    }
+}
+
 static void cnt_reset(Sum *s)
 {
     s->def.i = s->res.i = s->cnt = 0;
@@ -53,12 +69,19 @@ static void cnt_update(Sum *s, Tuple *t)
     s->def.i = s->res.i = s->cnt;
 }
 
+static void cnt_batch(Sum *s, Tuple *ts[], int len)
+{
+    s->cnt += len;
+    s->def.i = s->res.i = s->cnt;
+}
+
 extern Sum *sum_cnt()
 {
     Value v = {.size = 0, .data = NULL};
     Sum *res = alloc(sizeof(Sum), 0, Int, v);
     res->reset = cnt_reset;
     res->update = cnt_update;
+    res->batch = cnt_batch;
 
     return res;
 }
@@ -110,6 +133,78 @@ static void max_update(Sum *s, Tuple *t)
     s->cnt++;
 }
 
+static void min_data(Sum *s, void *data[], int len)
+{
+    if (len == 0)
+        return;
+
+    if (s->type == Int) {
+        int m = s->cnt == 0 ? int_dec(data[0]) : s->res.i;
+        for (int i = 0; i < len; ++i) {
+            int v = int_dec(data[i]);
+            m = v < m ? v : m;
+        }
+        s->res.i = m;
+    } else if (s->type == Real) {
+        double m = s->cnt == 0 ? real_dec(data[0]) : s->res.d;
+        for (int i = 0; i < len; ++i) {
+            double v = real_dec(data[i]);
+            m = m > v ? v : m;
+        }
+        s->res.d = m;
+    } else {
+        long long m = s->cnt == 0 ? long_dec(data[0]) : s->res.l;
+        for (int i = 0; i < len; ++i) {
+            long long v = long_dec(data[i]);
+            m = v < m ? v : m;
+        }
+        s->res.l = m;
+    }
+
+    s->cnt += len;
+}
+
+static void min_batch(Sum *s, Tuple *ts[], int len)
+{
+    chunks(s, ts, len, min_data);
+}
+
+static void max_data(Sum *s, void *data[], int len)
+{
+    if (len == 0)
+        return;
+
+    if (s->type == Int) {
+        int m = s->cnt == 0 ? int_dec(data[0]) : s->res.i;
+        for (int i = 0; i < len; ++i) {
+            int v = int_dec(data[i]);
+            m = v > m ? v : m;
+        }
+        s->res.i = m;
+    } else if (s->type == Real) {
+        double m = s->cnt == 0 ? real_dec(data[0]) : s->res.d;
+        for (int i = 0; i < len; ++i) {
+            double v = real_dec(data[i]);
+            m = m < v ? v : m;
+        }
+        s->res.d = m;
+    } else {
+        long long m = s->cnt == 0 ? long_dec(data[0]) : s->res.l;
+        for (int i = 0; i < len; ++i) {
+            long long v = long_dec(data[i]);
+            m = v > m ? v : m;
+        }
+        s->res.l = m;
+    }
+
+    s->cnt += len;
+}
+
+static void max_batch(Sum *s, Tuple *ts[], int len)
+{
+    chunks(s, ts, len, max_data);
+}
+
 static Sum *sum_mm_reset(int pos, Type t, Value def)
 {
     Sum *res = alloc(sizeof(Sum), pos, t, def);
@@ -122,6 +217,7 @@ extern Sum *sum_min(int pos, Type t, Value def)
 {
     Sum *res = sum_mm_reset(pos, t, def);
     res->update = min_update;
+    res->batch = min_batch;
 
     return res;
 }
@@ -130,6 +226,7 @@ extern Sum *sum_max(int pos, Type t, Value def)
 {
     Sum *res = sum_mm_reset(pos, t, def);
     res->update = max_update;
+    res->batch = max_batch;
 
     return res;
 }
@@ -173,11 +270,46 @@ static void avg_update(Sum *s, Tuple *t)
     }
 }
 
+static void avg_data(Sum *s, void *data[], int len)
+{
+    C_Avg *c = s->ctxt;
+    if (len == 0)
+        return;
+
+    s->cnt += len;
+
+    if (c->type == Int) {
+        int sum = c->sum.i;
+        for (int i = 0; i < len; ++i)
+            sum += int_dec(data[i]);
+        c->sum.i = sum;
+        s->res.d = (double) c->sum.i / s->cnt;
+    } else if (c->type == Real) {
+        double sum = c->sum.d;
+        for (int i = 0; i < len; ++i)
+            sum += real_dec(data[i]);
+        c->sum.d = sum;
+        s->res.d = c->sum.d / s->cnt;
+    } else {
+        long long sum = c->sum.l;
+        for (int i = 0; i < len; ++i)
+            sum += long_dec(data[i]);
+        c->sum.l = sum;
+        s->res.d = (double) c->sum.l / s->cnt;
+    }
+}
+
+static void avg_batch(Sum *s, Tuple *ts[], int len)
+{
+    chunks(s, ts, len, avg_data);
+}
+
 extern Sum *sum_avg(int pos, Type t, Value def)
 {
     Sum *res = alloc(sizeof(Sum) + sizeof(C_Avg), pos, Real, def);
     res->reset = avg_reset;
     res->update = avg_update;
+    res->batch = avg_batch;
 
     C_Avg *c = res->ctxt;
     c->type = t;
@@ -208,11 +340,39 @@ static void add_update(Sum *s, Tuple *t)
     s->cnt++;
 }
 
+static void add_data(Sum *s, void *data[], int len)
+{
+    if (s->type == Int) {
+        int sum = s->res.i;
+        for (int i = 0; i < len; ++i)
+            sum += int_dec(data[i]);
+        s->res.i = sum;
+    } else if (s->type == Real) {
+        double sum = s->res.d;
+        for (int i = 0; i < len; ++i)
+            sum += real_dec(data[i]);
+        s->res.d = sum;
+    } else {
+        long long sum = s->res.l;
+        for (int i = 0; i < len; ++i)
+            sum += long_dec(data[i]);
+        s->res.l = sum;
+    }
+
+    s->cnt += len;
+}
+
+static void add_batch(Sum *s, Tuple *ts[], int len)
+{
+    chunks(s, ts, len, add_data);
+}
+
 extern Sum *sum_add(int pos, Type t, Value def)
 {
     Sum *res = alloc(sizeof(Sum), pos, t, def);
     res->reset = add_reset;
     res->update = add_update;
+    res->batch = add_batch;
 
     return res;
 }
@@ -227,3 +387,20 @@ extern Value sum_value(Sum *s) {
         return s->cnt == 0 ? val_new_long(&(s->def.l)) : val_new_long(&(s->res.l));
 }
 
+extern Sum *sum_groups(Sum *s, int len)
+{
+    Sum *res = mem_alloc((long long) s->size * (len > 0 ? len : 1));
+    for (int i = 0; i < len; ++i) {
+        Sum *g = (Sum*) ((char*) res + (long long) s->size * i);
+        mem_cpy(g, s, s->size);
+        g->ctxt = g + 1;
+        sum_reset(g);
+    }
+
+    return res;
+}
+
+extern Sum *sum_group(Sum *groups, int idx)
+{
+    return (Sum*) ((char*) groups + (long long) groups->size * idx);
+}
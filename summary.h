@@ -16,6 +16,7 @@ limitations under the License.
 */
 
 struct Sum {
+    int size; /* bytes taken together with the ctxt */
     int cnt;
     int pos;
 
@@ -36,11 +37,13 @@ struct Sum {
 
     void (*reset)(struct Sum *self);
     void (*update)(struct Sum *self, Tuple *t);
+    void (*batch)(struct Sum *self, Tuple *ts[], int len);
 };
 typedef struct Sum Sum;
 
 #define sum_reset(s) (s->reset(s))
 #define sum_update(s, t) (s->update(s, t))
+#define sum_batch(s, ts, len) (s->batch(s, ts, len))
 
 extern Sum *sum_cnt();
 extern Sum *sum_avg(int pos, Type t, Value def);
@@ -49,3 +52,8 @@ extern Sum *sum_max(int pos, Type t, Value def);
 extern Sum *sum_add(int pos, Type t, Value def);
 
 extern Value sum_value(Sum *s);
+
+/* aggregates of len groups at once, each of them a reset copy of s (see
+   sum_group), freed with mem_free */
+extern Sum *sum_groups(Sum *s, int len);
+extern Sum *sum_group(Sum *groups, int idx);
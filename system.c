@@ -177,6 +177,9 @@ static IO *_sys_open(const char *path, int mode, int binary)
     if (mode & TRUNCATE)
         flags |= O_TRUNC;
 
+    if (mode & APPEND)
+        flags |= O_APPEND;
+
     int fd = -1;
     if (str_cmp(path, "-") == 0) {
         if (!(mode ^ READ))
@@ -426,6 +429,20 @@ extern int sys_exists(const char *path)
     return 1;
 }
 
+extern long long sys_fsize(const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) < 0) {
+        if (errno == ENOENT)
+            return 0;
+        else
+            sys_die("sys: cannot check %s size\n", path);
+    }
+
+    return st.st_size;
+}
+
 extern void sys_remove(const char *path)
 {
     if (unlink(path) < 0)
@@ -47,9 +47,11 @@ static const int CREATE = 0x01;
 static const int TRUNCATE = 0x02;
 static const int READ = 0x04;
 static const int WRITE = 0x08;
+static const int APPEND = 0x10;
 
 extern IO *sys_open(const char *path, int mode);
 extern int sys_exists(const char *path);
+extern long long sys_fsize(const char *path); /* 0 if there is no file */
 extern void sys_move(const char *dest, const char *src);
 extern void sys_cpy(const char *dest, const char *src);
 extern void sys_remove(const char *path);
@@ -57,15 +59,21 @@ extern char *sys_load(const char *path);
 extern char **sys_list(const char *dir, int *len);
 extern int sys_empty(const char *dir);
 
+/* read-only file mappings (the mapped file must not change) */
+extern void *sys_mmap(const char *path, long long *size);
+extern void sys_munmap(void *mem, long long size);
+
 /* [multi]proc */
 static const char PROC_OK = 0x00;
 static const char PROC_FAIL = 0x01;
 
 extern int sys_exec(char *const argv[]);
+extern int sys_exec_io(char *const argv[], IO *io); /* io is inherited */
 extern int sys_kill(int pid);
 extern char sys_wait(int pid);
 extern void sys_sleep(int secs);
 extern void sys_thread(void *(*fn)(void *arg), void *arg);
+extern int sys_cpus(); /* number of processors online (at least 1) */
 extern void sys_exit(char status);
 extern void sys_die(const char *msg, ...);
 
@@ -78,6 +86,14 @@ extern IO *sys_try_connect(const char *address, int chunked);
 extern int sys_iready(IO *io, int millis);
 extern void sys_proxy(IO *cio, int *ccnt, IO *pio, int *pcnt);
 
+/* hand over of open connections to a child process. sys_chan returns 0 if
+   the platform does not support it, otherwise chan[1] is the child's end
+   (see sys_exec_io) which the child reopens with sys_chan_open */
+extern int sys_chan(IO *chan[2]);
+extern IO *sys_chan_open(int fd);
+extern int sys_send_io(IO *chan, IO *io);
+extern IO *sys_recv_io(IO *chan); /* returns NULL if the channel stopped */
+
 /* misc */
 extern void sys_print(const char *msg, ...);
 extern void sys_log(char module, const char *msg, ...);
@@ -97,3 +113,13 @@ extern void mon_unlock(Mon *m);
 extern void mon_wait(Mon *m, int ms);
 extern void mon_signal(Mon *m);
 extern void mon_free(Mon *m);
+
+/* readiness notification (used from a single thread, except poll_wake) */
+typedef struct Poll Poll;
+
+extern Poll *poll_new();
+extern void poll_add(Poll *p, IO *io, void *data); /* reported only once */
+extern void poll_rm(Poll *p, IO *io);
+extern int poll_wait(Poll *p, void *ready[], int max, int ms);
+extern void poll_wake(Poll *p); /* interrupts poll_wait from other threads */
+extern void poll_free(Poll *p);
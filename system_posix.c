@@ -22,6 +22,7 @@ limitations under the License.
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -40,6 +41,10 @@ limitations under the License.
 #include <signal.h>
 #include <poll.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #include "config.h"
 #include "system.h"
 #include "memory.h"
@@ -74,10 +79,45 @@ extern IO *sys_open(const char *path, int mode)
     return _sys_open(path, mode, 0);
 }
 
+extern void *sys_mmap(const char *path, long long *size)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+        sys_die("sys: cannot open %s\n", path);
+
+    void *res = NULL;
+    *size = st.st_size;
+    if (*size > 0) {
+        res = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (res == MAP_FAILED)
+            sys_die("sys: cannot map %s\n", path);
+    }
+
+    if (close(fd) < 0)
+        sys_die("sys: cannot close file descriptor\n");
+
+    return res;
+}
+
+extern void sys_munmap(void *mem, long long size)
+{
+    if (mem != NULL && munmap(mem, size) < 0)
+        sys_die("sys: cannot unmap %lld bytes\n", size);
+}
+
 extern int sys_exec(char *const argv[])
+{
+    return sys_exec_io(argv, NULL);
+}
+
+extern int sys_exec_io(char *const argv[], IO *io)
 {
     pid_t pid;
     if ((pid = fork()) == 0) {
+        if (io != NULL && fcntl(io->fd, F_SETFD, 0) < 0)
+            sys_die("sys: cannot pass descriptor %d to a child\n", io->fd);
+
         execvp(argv[0], argv);
         sys_die("sys: execv of %s failed\n", argv[0]);
     } else if (pid < 0)
@@ -109,6 +149,12 @@ extern void sys_sleep(int secs)
     sleep(secs);
 }
 
+extern int sys_cpus()
+{
+    long res = sysconf(_SC_NPROCESSORS_ONLN);
+    return res < 1 ? 1 : (int) res;
+}
+
 extern void sys_thread(void *(*fn)(void *arg), void *arg)
 {
     pthread_t t;
@@ -153,6 +199,99 @@ extern int net_port(int fd)
     return ntohs(addr.sin_port);
 }
 
+static IO *new_chan_io(int fd)
+{
+    IO *io = new_net_io(fd, IO_STREAM);
+    io->close = fs_close; /* no shutdown, the peer may still use it */
+
+    return io;
+}
+
+extern int sys_chan(IO *chan[2])
+{
+    int type = SOCK_STREAM, fd[2];
+#ifdef SOCK_CLOEXEC
+    type |= SOCK_CLOEXEC;
+#endif
+    if (socketpair(AF_UNIX, type, 0, fd) < 0)
+        sys_die("sys: cannot create a channel\n");
+
+    for (int i = 0; i < 2; ++i) {
+        if (fcntl(fd[i], F_SETFD, FD_CLOEXEC) < 0)
+            sys_die("sys: cannot configure descriptor %d\n", fd[i]);
+
+        chan[i] = new_chan_io(fd[i]);
+    }
+
+    return 1;
+}
+
+extern IO *sys_chan_open(int fd)
+{
+    return new_chan_io(fd);
+}
+
+extern int sys_send_io(IO *chan, IO *io)
+{
+    char b = 0, ctl[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = &b, .iov_len = 1};
+    struct msghdr msg;
+
+    mem_set(ctl, 0, sizeof(ctl));
+    mem_set(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    mem_cpy(CMSG_DATA(c), &io->fd, sizeof(int));
+
+    int w = -1;
+    do {
+        w = sendmsg(chan->fd, &msg, 0);
+    } while (w < 0 && errno == EINTR);
+
+    if (w != 1)
+        chan->stop |= IO_ERROR;
+
+    return chan->stop ? -1 : 1;
+}
+
+extern IO *sys_recv_io(IO *chan)
+{
+    char b = 0, ctl[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = &b, .iov_len = 1};
+    struct msghdr msg;
+
+    mem_set(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+
+    int r = -1;
+    do {
+        r = recvmsg(chan->fd, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+
+    struct cmsghdr *c = r == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (c == NULL || c->cmsg_level != SOL_SOCKET ||
+        c->cmsg_type != SCM_RIGHTS)
+    {
+        chan->stop |= r == 0 ? IO_CLOSE : IO_ERROR;
+        return NULL;
+    }
+
+    int fd = -1;
+    mem_cpy(&fd, CMSG_DATA(c), sizeof(int));
+
+    return new_chan_io(fd);
+}
+
 extern Mon *mon_new()
 {
     Mon *res = mem_alloc(sizeof(Mon) +
@@ -233,3 +372,190 @@ extern void mon_free(Mon *m)
 
     mem_free(m);
 }
+
+/* poll_* use epoll on linux and poll(2) elsewhere. in both cases the pipe
+   is used to interrupt poll_wait from other threads */
+#ifdef __linux__
+
+struct Poll {
+    int wake[2];
+    int fd;
+};
+
+static void poll_ctl(Poll *p, int op, int fd, void *data)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = data};
+    if (data != p)
+        ev.events |= EPOLLONESHOT;
+
+    if (epoll_ctl(p->fd, op, fd, &ev) < 0)
+        sys_die("sys: cannot watch file descriptor %d\n", fd);
+}
+
+extern Poll *poll_new()
+{
+    Poll *p = mem_alloc(sizeof(Poll));
+    if (pipe(p->wake) < 0 || fcntl(p->wake[1], F_SETFL, O_NONBLOCK) < 0)
+        sys_die("sys: cannot create a pipe\n");
+
+    p->fd = epoll_create(64);
+    if (p->fd < 0)
+        sys_die("sys: cannot create epoll descriptor\n");
+
+    poll_ctl(p, EPOLL_CTL_ADD, p->wake[0], p);
+
+    return p;
+}
+
+extern void poll_add(Poll *p, IO *io, void *data)
+{
+    /* a reported descriptor stays in the set (disabled) until removed */
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT,
+                             .data.ptr = data};
+    if (epoll_ctl(p->fd, EPOLL_CTL_ADD, io->fd, &ev) < 0) {
+        if (errno != EEXIST)
+            sys_die("sys: cannot watch file descriptor %d\n", io->fd);
+
+        poll_ctl(p, EPOLL_CTL_MOD, io->fd, data);
+    }
+}
+
+extern void poll_rm(Poll *p, IO *io)
+{
+    struct epoll_event ev;
+    if (epoll_ctl(p->fd, EPOLL_CTL_DEL, io->fd, &ev) < 0 && errno != ENOENT)
+        sys_die("sys: cannot unwatch file descriptor %d\n", io->fd);
+}
+
+extern int poll_wait(Poll *p, void *ready[], int max, int ms)
+{
+    struct epoll_event evs[max];
+
+    int n = -1;
+    do {
+        n = epoll_wait(p->fd, evs, max, ms < 0 ? -1 : ms);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        sys_die("sys: epoll wait failed\n");
+
+    int res = 0;
+    for (int i = 0; i < n; ++i)
+        if (evs[i].data.ptr == p) {
+            char buf[64];
+            if (read(p->wake[0], buf, sizeof(buf)) < 0)
+                sys_die("sys: cannot read from a pipe\n");
+        } else
+            ready[res++] = evs[i].data.ptr;
+
+    return res;
+}
+
+extern void poll_free(Poll *p)
+{
+    close(p->fd);
+    close(p->wake[0]);
+    close(p->wake[1]);
+    mem_free(p);
+}
+
+#else
+
+struct Poll {
+    int wake[2];
+    struct pollfd *fds;
+    void **data;
+    int len;
+    int size;
+};
+
+extern Poll *poll_new()
+{
+    Poll *p = mem_alloc(sizeof(Poll));
+    if (pipe(p->wake) < 0 || fcntl(p->wake[1], F_SETFL, O_NONBLOCK) < 0)
+        sys_die("sys: cannot create a pipe\n");
+
+    p->size = 64;
+    p->fds = mem_alloc(p->size * sizeof(struct pollfd));
+    p->data = mem_alloc(p->size * sizeof(void*));
+
+    p->fds[0].fd = p->wake[0];
+    p->fds[0].events = POLLIN;
+    p->len = 1;
+
+    return p;
+}
+
+extern void poll_add(Poll *p, IO *io, void *data)
+{
+    if (p->len == p->size) {
+        p->size *= 2;
+        p->fds = mem_realloc(p->fds, p->size * sizeof(struct pollfd));
+        p->data = mem_realloc(p->data, p->size * sizeof(void*));
+    }
+
+    p->fds[p->len].fd = io->fd;
+    p->fds[p->len].events = POLLIN;
+    p->data[p->len] = data;
+    p->len++;
+}
+
+static void poll_del(Poll *p, int idx)
+{
+    p->len--;
+    p->fds[idx] = p->fds[p->len];
+    p->data[idx] = p->data[p->len];
+}
+
+extern void poll_rm(Poll *p, IO *io)
+{
+    for (int i = 1; i < p->len; ++i)
+        if (p->fds[i].fd == io->fd) {
+            poll_del(p, i);
+            break;
+        }
+}
+
+extern int poll_wait(Poll *p, void *ready[], int max, int ms)
+{
+    int n = -1;
+    do {
+        n = poll(p->fds, p->len, ms < 0 ? -1 : ms);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        sys_die("sys: poll failed\n");
+
+    int res = 0;
+    for (int i = p->len - 1; i > 0 && res < max; --i)
+        if (p->fds[i].revents != 0) {
+            ready[res++] = p->data[i];
+            poll_del(p, i);
+        }
+
+    if (p->fds[0].revents != 0) {
+        char buf[64];
+        if (read(p->wake[0], buf, sizeof(buf)) < 0)
+            sys_die("sys: cannot read from a pipe\n");
+    }
+
+    return res;
+}
+
+extern void poll_free(Poll *p)
+{
+    close(p->wake[0]);
+    close(p->wake[1]);
+    mem_free(p->fds);
+    mem_free(p->data);
+    mem_free(p);
+}
+
+#endif
+
+extern void poll_wake(Poll *p)
+{
+    /* a full pipe means there is a pending wake up already */
+    if (write(p->wake[1], "", 1) < 0 && errno != EAGAIN)
+        sys_die("sys: cannot write to a pipe\n");
+}
@@ -79,6 +79,33 @@ extern IO *sys_open(const char *path, int mode)
     return _sys_open(path, mode, O_BINARY);
 }
 
+/* no mapping on win32, the file content is loaded into memory instead */
+extern void *sys_mmap(const char *path, long long *size)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+        sys_die("sys: cannot open %s\n", path);
+
+    void *res = NULL;
+    *size = st.st_size;
+    if (*size > 0) {
+        res = mem_alloc(*size);
+
+        IO *io = sys_open(path, READ);
+        if (sys_readn(io, res, *size) != *size)
+            sys_die("sys: cannot read %s\n", path);
+        sys_close(io);
+    }
+
+    return res;
+}
+
+extern void sys_munmap(void *mem, long long size)
+{
+    if (mem != NULL)
+        mem_free(mem);
+}
+
 extern int sys_exec(char *const a[])
 {
     STARTUPINFO si;
@@ -102,6 +129,14 @@ extern int sys_exec(char *const a[])
     return pi.dwProcessId;
 }
 
+extern int sys_exec_io(char *const a[], IO *io)
+{
+    if (io != NULL)
+        sys_die("sys: passing descriptors is not supported\n");
+
+    return sys_exec(a);
+}
+
 extern int sys_kill(int pid)
 {
     HANDLE ph = OpenProcess(PROCESS_ALL_ACCESS, FALSE, pid);
@@ -137,6 +172,14 @@ extern void sys_sleep(int secs)
     Sleep(secs * 1000);
 }
 
+extern int sys_cpus()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors < 1 ? 1 : (int) info.dwNumberOfProcessors;
+}
+
 extern void sys_thread(void *(*fn)(void *arg), void *arg)
 {
     DWORD id;
@@ -175,6 +218,30 @@ extern int net_port(int fd)
     return ntohs(addr.sin_port);
 }
 
+/* there are no channels on windows, the callers fall back to sys_proxy */
+extern int sys_chan(IO *chan[2])
+{
+    return 0;
+}
+
+extern IO *sys_chan_open(int fd)
+{
+    sys_die("sys: channels are not supported\n");
+    return NULL;
+}
+
+extern int sys_send_io(IO *chan, IO *io)
+{
+    sys_die("sys: channels are not supported\n");
+    return -1;
+}
+
+extern IO *sys_recv_io(IO *chan)
+{
+    sys_die("sys: channels are not supported\n");
+    return NULL;
+}
+
 extern Mon *mon_new()
 {
     Mon *res = mem_alloc(sizeof(Mon));
@@ -229,3 +296,95 @@ extern void mon_free(Mon *m)
     DeleteCriticalSection(m->mutex);
     mem_free(m);
 }
+
+/* there is no readiness notification for many sockets on win32, poll_wait
+   checks the sockets with select in batches of FD_SETSIZE and returns at
+   least every 10ms (so it does not need to be woken up) */
+struct Poll {
+    IO **ios;
+    void **data;
+    int len;
+    int size;
+};
+
+extern Poll *poll_new()
+{
+    Poll *p = mem_alloc(sizeof(Poll));
+    p->len = 0;
+    p->size = 64;
+    p->ios = mem_alloc(p->size * sizeof(IO*));
+    p->data = mem_alloc(p->size * sizeof(void*));
+
+    return p;
+}
+
+extern void poll_add(Poll *p, IO *io, void *data)
+{
+    if (p->len == p->size) {
+        p->size *= 2;
+        p->ios = mem_realloc(p->ios, p->size * sizeof(IO*));
+        p->data = mem_realloc(p->data, p->size * sizeof(void*));
+    }
+
+    p->ios[p->len] = io;
+    p->data[p->len] = data;
+    p->len++;
+}
+
+static void poll_del(Poll *p, int idx)
+{
+    p->len--;
+    p->ios[idx] = p->ios[p->len];
+    p->data[idx] = p->data[p->len];
+}
+
+extern void poll_rm(Poll *p, IO *io)
+{
+    for (int i = 0; i < p->len; ++i)
+        if (p->ios[i] == io) {
+            poll_del(p, i);
+            break;
+        }
+}
+
+extern int poll_wait(Poll *p, void *ready[], int max, int ms)
+{
+    if (ms < 0 || ms > 10)
+        ms = 10;
+
+    if (p->len == 0) {
+        Sleep(ms);
+        return 0;
+    }
+
+    int res = 0;
+    for (int off = p->len - 1; off >= 0 && res < max; off -= FD_SETSIZE) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        for (int i = off; i >= 0 && i > off - FD_SETSIZE; --i)
+            FD_SET(p->ios[i]->fd, &rfds);
+
+        struct timeval tv = {.tv_sec = 0, .tv_usec = ms * 1000};
+        if (select(0, &rfds, NULL, NULL, &tv) == SOCKET_ERROR)
+            sys_die("sys: select failed\n");
+        ms = 0;
+
+        for (int i = off; i >= 0 && i > off - FD_SETSIZE && res < max; --i)
+            if (FD_ISSET(p->ios[i]->fd, &rfds)) {
+                ready[res++] = p->data[i];
+                poll_del(p, i);
+            }
+    }
+
+    return res;
+}
+
+extern void poll_wake(Poll *p) {}
+
+extern void poll_free(Poll *p)
+{
+    mem_free(p->ios);
+    mem_free(p->data);
+    mem_free(p);
+}
+
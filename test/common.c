@@ -75,6 +75,8 @@ extern Rel *gen_rel(int start, int end)
     res->head = gen_head();
     res->eval = eval_gen;
     res->free = free_gen;
+    res->open = NULL;
+    res->next = NULL;
     res->ctxt = NULL;
     res->body = gen_tuples(start, end);
 
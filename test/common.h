@@ -36,6 +36,7 @@ limitations under the License.
 #include "../pack.h"
 #include "../http.h"
 #include "../index.h"
+#include "../hash.h"
 
 #define fail() fail_test(__LINE__);
 
@@ -47,7 +48,6 @@ extern Rel *gen_rel(int start, int end);
 
 /* from tuple.c */
 extern Tuple *tuple_dec(void *mem, int *len);
-extern int tuple_enc(Tuple *t, void *buf);
 
 /* from transaction.c */
 extern long long enter(const char *eid, Vars *rvars, Vars *wvars, Mon *m);
@@ -339,6 +339,109 @@ static void test_conv()
             expr_long(123LL));
 }
 
+static void test_fold()
+{
+    int i = 5;
+    Value vals[1];
+    vals[0] = val_new_int(&i);
+    Tuple *t = tuple_new(vals, 1);
+
+    /* constant operands are folded, the rest is evaluated per tuple */
+    Expr *e = expr_sum(expr_attr(0, Int),
+                       expr_mul(expr_int(3), expr_sub(expr_int(7),
+                                                      expr_int(3))));
+    for (int k = 0; k < 2; ++k)
+        if (val_int(expr_new_val(e, t, NULL)) != 17)
+            fail();
+    expr_free(e);
+
+    e = expr_and(expr_not(expr_lt(expr_real(1.5), expr_real(0.5))),
+                 expr_eq(expr_str_index(expr_str("abc"), expr_str("c")),
+                         expr_int(2)));
+    if (!expr_bool_val(e, NULL, NULL))
+        fail();
+    expr_free(e);
+
+    Arg arg;
+    arg.vals[0].v_long = 40;
+    e = expr_gte(expr_param(0, Long), expr_sum(expr_long(20), expr_long(20)));
+    if (!expr_bool_val(e, NULL, &arg))
+        fail();
+    arg.vals[0].v_long = 39;
+    if (expr_bool_val(e, NULL, &arg))
+        fail();
+    expr_free(e);
+
+    tuple_free(t);
+}
+
+static void test_batch()
+{
+    char *names[] = {"a", "b", "c"};
+    Type types[] = {Int, Real, String};
+
+    int a, b, c;
+    Type ta, tb, tc;
+    Head *h = head_new(names, types, 3);
+    head_attr(h, "a", &a, &ta);
+    head_attr(h, "b", &b, &tb);
+    head_attr(h, "c", &c, &tc);
+
+    int len = 100;
+    Tuple *ts[len];
+    for (int i = 0; i < len; ++i) {
+        char buf[32];
+        double d = i / 3.0;
+        str_print(buf, "str_%d", i % 7);
+
+        Value vals[3];
+        vals[0] = val_new_int(&i);
+        vals[1] = val_new_real(&d);
+        vals[2] = val_new_str(buf);
+        ts[i] = tuple_new(vals, 3);
+    }
+
+    Arg arg;
+    arg.vals[0].v_long = 50;
+
+    Expr *exprs[] = {
+        expr_or(expr_and(expr_gt(expr_attr(b, Real), expr_real(4.0)),
+                         expr_not(expr_eq(expr_attr(c, String),
+                                          expr_str("str_3")))),
+                expr_lte(expr_conv(expr_attr(a, Int), Long),
+                         expr_param(0, Long))),
+        expr_sum(expr_mul(expr_attr(a, Int), expr_int(3)), expr_int(-7)),
+        expr_div(expr_attr(b, Real), expr_conv(expr_attr(a, Int), Real)),
+        expr_str_index(expr_attr(c, String), expr_str("_4")),
+        expr_attr(c, String)
+    };
+
+    int sel[len];
+    for (int k = 0; k < 5; ++k) {
+        Expr *e = exprs[k];
+        expr_batch(e, ts, len, &arg);
+        for (int i = 0; i < len; ++i) {
+            Value v = expr_new_val(e, ts[i], &arg);
+            if (val_cmp(v, expr_batch_val(e, i)) != 0)
+                fail();
+        }
+    }
+
+    int cnt = expr_batch_sel(exprs[0], ts, len, &arg, sel);
+    for (int i = 0, j = 0; i < len; ++i)
+        if (expr_bool_val(exprs[0], ts[i], &arg)) {
+            if (j >= cnt || sel[j++] != i)
+                fail();
+        } else if (j < cnt && sel[j] == i)
+            fail();
+
+    for (int k = 0; k < 5; ++k)
+        expr_free(exprs[k]);
+    for (int i = 0; i < len; ++i)
+        tuple_free(ts[i]);
+    mem_free(h);
+}
+
 int main()
 {
     test_bool_vals();
@@ -349,6 +452,8 @@ int main()
     test_param();
     test_compound();
     test_conv();
+    test_fold();
+    test_batch();
 
     return 0;
 }
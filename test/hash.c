@@ -0,0 +1,84 @@
+/*
+Copyright 2012 Ostap Cherkashin
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "common.h"
+
+static void test_find(int pos[], int len)
+{
+    TBuf *b = gen_tuples(-300, 300);
+    Hash *h = hash_build(b, pos, len);
+    if (h->len != b->len)
+        fail();
+
+    for (int i = -300; i < 300; ++i) {
+        Tuple *t = gen_tuple(i);
+        int idx = hash_find(h, t, pos);
+        if (idx < 0)
+            fail();
+        if (tuple_cmp(t, h->tuples[idx], pos, pos, len) != 0)
+            fail();
+        if (hash_next(h, idx, t, pos) > -1)
+            fail();
+
+        tuple_free(t);
+    }
+
+    Tuple *t = gen_tuple(505);
+    if (hash_has(h, t, pos))
+        fail();
+    tuple_free(t);
+
+    hash_free(h);
+    tbuf_clean(b);
+    tbuf_free(b);
+}
+
+static void test_duplicates()
+{
+    /* hash on the first attribute only */
+    int pos[] = {0};
+    Hash *h = hash_new(pos, 1, 0);
+
+    Tuple *t = gen_tuple(7);
+    for (int i = 0; i < 100; ++i)
+        hash_add(h, t);
+    if (h->len != 100)
+        fail();
+
+    int cnt = 0;
+    for (int i = hash_find(h, t, pos); i > -1; i = hash_next(h, i, t, pos))
+        cnt++;
+    if (cnt != 100)
+        fail();
+
+    tuple_free(t);
+    hash_free(h);
+}
+
+int main()
+{
+    Head *h = gen_head();
+    int lpos[MAX_ATTRS], rpos[MAX_ATTRS];
+    int len = head_common(h, h, lpos, rpos);
+
+    test_find(lpos, len);
+    test_find(lpos, 1);
+    test_duplicates();
+
+    mem_free(h);
+
+    return 0;
+}
@@ -24,6 +24,21 @@ static void test_sort(int pos[], int len, int start, int end)
     tbuf_free(b);
 }
 
+static void test_dups(int pos[], int len)
+{
+    TBuf *b = tbuf_new();
+    for (int i = 0; i < 1000; ++i)
+        tbuf_add(b, gen_tuple(i % 7));
+
+    index_sort(b, pos, len);
+    for (int i = 1; i < b->len; ++i)
+        if (tuple_cmp(b->buf[i - 1], b->buf[i], pos, pos, len) > 0)
+            fail();
+
+    tbuf_clean(b);
+    tbuf_free(b);
+}
+
 static void test_find_match(int pos[], int len)
 {
     TBuf *b = gen_tuples(-300, 300);
@@ -67,6 +82,52 @@ static void test_find_match(int pos[], int len)
     tbuf_free(b);
 }
 
+static void test_order(int pos[], int len)
+{
+    TBuf *b = gen_tuples(0, 100);
+    if (index_sorted(b, pos, len))
+        fail();
+
+    index_sort(b, pos, len);
+    if (!index_sorted(b, pos, len) || !index_sorted(b, pos, 1))
+        fail();
+    if (len > 1 && index_sorted(b, pos + 1, 1))
+        fail();
+
+    TBuf *s = tbuf_share(b);
+    if (!index_sorted(s, pos, len))
+        fail();
+
+    tbuf_add(b, gen_tuple(-1));
+    if (index_sorted(b, pos, len))
+        fail();
+
+    tbuf_clean(s);
+    tbuf_free(s);
+    tbuf_clean(b);
+    tbuf_free(b);
+}
+
+static void test_values()
+{
+    TBuf *b = gen_tuples(-100, 100);
+    int pos[] = {0};
+    Type types[] = {Int};
+
+    /* numbers by their value, unlike index_sort */
+    index_sort(b, pos, 1);
+    index_order(b, pos, types, 1);
+    if (index_sorted(b, pos, 1) || val_int(tuple_attr(b->buf[0], 0)) != -100)
+        fail();
+
+    for (int i = 1; i < b->len; ++i)
+        if (val_int(tuple_attr(b->buf[i], 0)) != i - 100)
+            fail();
+
+    tbuf_clean(b);
+    tbuf_free(b);
+}
+
 int main()
 {
     Head *h = gen_head();
@@ -77,8 +138,13 @@ int main()
     test_sort(lpos, len, 0, 1);
     test_sort(lpos, len, -1, 1);
     test_sort(lpos, len, -337, 12);
+    test_sort(lpos, len, -50000, 50000);
+    test_sort(lpos + 1, 1, -500, 500);
+    test_dups(lpos, len);
 
     test_find_match(lpos, len);
+    test_order(lpos, len);
+    test_values();
 
     mem_free(h);
 
@@ -66,6 +66,8 @@ static void test_rel_vars()
 {
     OK("rel_var_basic.b");
     OK("rel_var_multiple_decls.b");
+    OK("rel_var_index.b");
+    OK("rel_var_index_name.b");
     FAIL("rel_var_unknown_type_err.b");
     FAIL("rel_var_redecl_err.b");
     FAIL("rel_var_redecl_2_err.b");
@@ -74,6 +76,9 @@ static void test_rel_vars()
     FAIL("rel_var_redecl_5_err.b");
     FAIL("rel_var_name_err.b");
     FAIL("rel_var_max_vars_err.b");
+    FAIL("rel_var_index_attr_err.b");
+    FAIL("rel_var_index_word_err.b");
+    FAIL("rel_var_index_type_err.b");
 }
 
 static void test_func()
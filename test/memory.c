@@ -43,8 +43,39 @@ static void test_cmp()
         fail();
 }
 
+static void test_arena()
+{
+    Arena *a = arena_new();
+
+    for (int round = 0; round < 3; ++round) {
+        int *small[NUM_CHUNKS];
+        for (int i = 0; i < NUM_CHUNKS; ++i) {
+            small[i] = arena_alloc(a, CHUNK_SZ * (i + 1));
+            mem_set(small[i], i, CHUNK_SZ * (i + 1));
+        }
+
+        /* bigger than a chunk */
+        char *big = arena_alloc(a, 3 << 20);
+        mem_set(big, 7, 3 << 20);
+
+        for (int i = 0; i < NUM_CHUNKS; ++i) {
+            if ((long long) small[i] % 8 != 0)
+                fail();
+
+            unsigned char *p = (unsigned char*) small[i];
+            if (p[0] != i || p[CHUNK_SZ * (i + 1) - 1] != i)
+                fail();
+        }
+
+        arena_reset(a);
+    }
+
+    arena_free(a);
+}
+
 int main()
 {
     test_realloc();
     test_cmp();
+    test_arena();
 }
@@ -32,6 +32,92 @@ static void test_basic(IO *sio, char *exec, char *addr)
     sys_close(pio);
 }
 
+static void test_poll(IO *sio, char *addr)
+{
+    Poll *p = poll_new();
+    IO *c1 = sys_connect(addr, IO_STREAM);
+    IO *s1 = sys_accept(sio, IO_STREAM);
+    IO *c2 = sys_connect(addr, IO_STREAM);
+    IO *s2 = sys_accept(sio, IO_STREAM);
+
+    void *ready[4];
+    poll_add(p, s1, s1);
+    poll_add(p, s2, s2);
+    if (poll_wait(p, ready, 4, 0) != 0)
+        fail();
+
+    if (sys_write(c2, "hello", 6) < 0)
+        fail();
+    if (poll_wait(p, ready, 4, 1000) != 1 || ready[0] != s2)
+        fail();
+
+    /* reported only once */
+    if (poll_wait(p, ready, 4, 0) != 0)
+        fail();
+
+    poll_rm(p, s1);
+    if (sys_write(c1, "hello", 6) < 0)
+        fail();
+    if (poll_wait(p, ready, 4, 100) != 0)
+        fail();
+
+    poll_add(p, s1, s1);
+    if (poll_wait(p, ready, 4, 1000) != 1 || ready[0] != s1)
+        fail();
+
+    poll_add(p, s2, s2);
+    if (poll_wait(p, ready, 4, 1000) != 1 || ready[0] != s2)
+        fail();
+
+    poll_wake(p);
+    if (poll_wait(p, ready, 4, -1) != 0)
+        fail();
+
+    sys_close(c1);
+    sys_close(s1);
+    sys_close(c2);
+    sys_close(s2);
+    poll_free(p);
+}
+
+static void test_chan(IO *sio, char *exec, char *addr)
+{
+    IO *chan[2];
+    if (!sys_chan(chan))
+        return;
+
+    char fd[8];
+    str_print(fd, "%d", chan[1]->fd);
+    char *a[] = {exec, "chan", fd, NULL};
+    int pid = sys_exec_io(a, chan[1]);
+    sys_close(chan[1]);
+
+    IO *c = sys_connect(addr, IO_STREAM);
+    IO *s = sys_accept(sio, IO_STREAM);
+    if (sys_send_io(chan[0], s) < 0)
+        fail();
+
+    /* the child answers on the passed connection */
+    char buf[16], stop = -1;
+    if (sys_readn(c, buf, 6) != 6 || str_cmp(buf, "hello") != 0)
+        fail();
+    if (sys_readn(chan[0], &stop, 1) != 1 || stop != 0)
+        fail();
+
+    /* the connection outlives the child's copy */
+    if (sys_write(s, "world", 6) < 0)
+        fail();
+    if (sys_readn(c, buf, 6) != 6 || str_cmp(buf, "world") != 0)
+        fail();
+
+    sys_close(chan[0]);
+    if (sys_wait(pid) != PROC_OK)
+        fail();
+
+    sys_close(c);
+    sys_close(s);
+}
+
 static char OK = 48;
 static char WAIT = 49;
 static char DISCONNECT = 50;
@@ -101,6 +187,29 @@ static void _client(char *addr, char *m)
     sys_close(io);
 }
 
+static void _chan(char *fd)
+{
+    int e = -1;
+    IO *chan = sys_chan_open(str_int(fd, &e));
+    IO *io = sys_recv_io(chan);
+    if (e || io == NULL)
+        fail();
+
+    if (sys_write(io, "hello", 6) < 0)
+        fail();
+
+    char stop = io->stop;
+    sys_close(io);
+    if (sys_write(chan, &stop, 1) < 0)
+        fail();
+
+    /* wait for the parent to close the channel */
+    if (sys_recv_io(chan) != NULL || !(chan->stop & IO_CLOSE))
+        fail();
+
+    sys_close(chan);
+}
+
 static void _processor(char *addr, char *m)
 {
     IO *io = sys_connect(addr, IO_CHUNK);
@@ -137,6 +246,8 @@ int main(int argc, char *argv[])
         str_print(addr, "127.0.0.1:%d", p);
 
         test_basic(sio, argv[0], addr);
+        test_poll(sio, addr);
+        test_chan(sio, argv[0], addr);
 
         test_proxy(sio, argv[0], addr, WAIT, ERR_PARTIAL);
         test_proxy(sio, argv[0], addr, OK, OK);
@@ -146,6 +257,8 @@ int main(int argc, char *argv[])
         sys_close(sio);
     } else if (str_cmp(argv[1], "basic") == 0) {
         _basic(argv[2]);
+    } else if (str_cmp(argv[1], "chan") == 0) {
+        _chan(argv[2]);
     } else if (str_cmp(argv[1], "client") == 0) {
         _client(argv[2], argv[3]);
     } else if (str_cmp(argv[1], "processor") == 0) {
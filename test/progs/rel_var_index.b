@@ -0,0 +1,15 @@
+type user {id int, name string, score real}
+
+var users user index(id, name, score);
+
+var logins {id int, at long} index id;
+
+fn find(key int) user
+{
+	return (select id == key users);
+}
+
+fn active(who string) {id int, at long}
+{
+	return (join logins (project (id) (select name == who users)));
+}
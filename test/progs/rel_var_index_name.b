@@ -0,0 +1,13 @@
+type entry {index int, name string}
+
+var index entry index(index);
+
+fn find(key int) entry
+{
+	return (select index == key index);
+}
+
+fn index_of(who string) {index int}
+{
+	return (project (index) (select name == who index));
+}
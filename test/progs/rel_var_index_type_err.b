@@ -0,0 +1,3 @@
+type user {id int, name string}
+
+var users index(id);
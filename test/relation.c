@@ -21,6 +21,8 @@ static Vars *vars = NULL;
 static Vars *rvars = NULL;
 static Env *env = NULL;
 static Arg arg;
+static char *vid = NULL;
+static long long read_ver = 0;
 
 static Rel *pack(char *str, char *names[], Type types[], int len)
 {
@@ -57,6 +59,15 @@ static Rel *load(const char *name)
     return rel_load(head, name);
 }
 
+static Rel *load_indexed(const char *name)
+{
+    int idx = array_scan(env->vars.names, env->vars.len, name);
+    if (idx < 0 || env->vars.indexes[idx] == NULL)
+        fail();
+
+    return rel_load_indexed(env->vars.heads[idx], name, env->vars.indexes[idx]);
+}
+
 static void load_vars()
 {
     for (int i = 0; i < rvars->len; ++i) {
@@ -67,6 +78,7 @@ static void load_vars()
         vars->vals[pos] = vol_read(rvars->vols[i],
                                    rvars->names[i],
                                    rvars->vers[i]);
+        tbuf_sorted(vars->vals[pos], rvars->stats[i]);
     }
 }
 
@@ -189,6 +201,41 @@ static void test_clone()
         fail();
 }
 
+static void test_reset()
+{
+    Rel *r = rel_select(load("two_r2"), expr_true());
+    Vars *wvars = vars_new(0);
+
+    long long sid = tx_enter("", rvars, wvars);
+    load_vars();
+
+    /* the first evaluation result is left unconsumed */
+    rel_eval(r, vars, &arg);
+    rel_reset(r);
+    if (r->body != NULL)
+        fail();
+
+    rel_eval(r, vars, &arg);
+
+    Tuple *t;
+    int i = 0;
+    while ((t = tbuf_next(r->body)) != NULL) {
+        tuple_free(t);
+        i++;
+    }
+
+    if (i != 2)
+        fail();
+
+    rel_reset(r);
+    rel_free(r);
+    free_vars();
+
+    tx_commit(sid);
+
+    vars_free(wvars);
+}
+
 static void test_eq()
 {
     if (equal(load("empty_r1"), "empty_r2"))
@@ -231,6 +278,147 @@ static void test_store()
     /* TODO: test reassignment in one statement logic */
 }
 
+static long long store(const char *name, TBuf *body)
+{
+    Vars *r = vars_new(0), *w = vars_new(1);
+    vars_add(w, name, 0, NULL);
+
+    long long sid = tx_enter("", r, w);
+    vol_write(w->vols[0], body, w->names[0], w->vers[0]);
+    tx_commit(sid);
+
+    long long res = w->vers[0];
+    tbuf_free(body);
+    vars_free(r);
+    vars_free(w);
+
+    return res;
+}
+
+static void test_delta()
+{
+    store("tx_target1", gen_tuples(0, 100));
+    long long ver = store("tx_target1", gen_tuples(1, 101));
+
+    /* a small change is stored as a delta */
+    char file[MAX_FILE_PATH];
+    str_print(file, "bin/volume/tx_target1-%016llX", ver);
+
+    int marker = 0;
+    IO *io = sys_open(file, READ);
+    if (sys_readn(io, &marker, sizeof(marker)) != sizeof(marker))
+        fail();
+    if (marker != -1)
+        fail();
+    sys_close(io);
+
+    Vars *r = vars_new(1), *w = vars_new(0);
+    vars_add(r, "tx_target1", 0, NULL);
+
+    long long sid = tx_enter("", r, w);
+    TBuf *body = vol_read(r->vols[0], r->names[0], r->vers[0]);
+    tx_commit(sid);
+
+    int pos[] = {0, 1};
+    TBuf *exp = gen_tuples(1, 101);
+    Hash *h = hash_build(exp, pos, 2);
+    if (body->len != exp->len)
+        fail();
+    for (int i = 0; i < body->len; ++i)
+        if (!hash_has(h, body->buf[i], pos))
+            fail();
+
+    hash_free(h);
+    tbuf_clean(exp);
+    tbuf_free(exp);
+    tbuf_clean(body);
+    tbuf_free(body);
+    vars_free(r);
+    vars_free(w);
+}
+
+/* the delta marker and the base of a version (the marker is 0 if the file
+   cannot be read) */
+static int delta(const char *name, long long ver, long long *base)
+{
+    char file[MAX_FILE_PATH];
+    str_print(file, "bin/volume/%s-%016llX", name, ver);
+
+    int marker = 0, depth = 0;
+    if (!sys_exists(file))
+        return 0;
+
+    IO *io = sys_open(file, READ);
+    if (sys_readn(io, &marker, sizeof(marker)) != sizeof(marker) ||
+        sys_readn(io, &depth, sizeof(depth)) != sizeof(depth) ||
+        sys_readn(io, base, sizeof(*base)) != sizeof(*base))
+        fail();
+    sys_close(io);
+
+    return marker;
+}
+
+/* reads a version of tx_target2 until the monitor value is set */
+static void *read_thread(void *arg)
+{
+    Mon *m = arg;
+    int stop = 0;
+    while (!stop) {
+        TBuf *b = vol_read(vid, "tx_target2", read_ver);
+        if (b->len != 100)
+            fail();
+
+        tbuf_clean(b);
+        tbuf_free(b);
+
+        mon_lock(m);
+        if ((stop = m->value) != 0) {
+            m->value = 0;
+            mon_signal(m);
+        }
+        mon_unlock(m);
+    }
+
+    return NULL;
+}
+
+static void test_compact()
+{
+    /* a change too big for the base is compacted by the next sync */
+    store("tx_target2", gen_tuples(0, 100));
+    long long ver = store("tx_target2", gen_tuples(20, 120)), base = 0;
+    if (delta("tx_target2", ver, &base) != -1)
+        fail();
+
+    Mon *m = mon_new();
+    read_ver = ver;
+    sys_thread(read_thread, m);
+
+    /* while the version is in use a read might still walk the chain it had
+       (N.B. a tx cannot be kept open here as the sync enters one as well) */
+    long long tmp = 0;
+    vol_sync();
+    if (delta("tx_target2", ver, &tmp) == -1)
+        fail();
+
+    vol_sync();
+    if (delta("tx_target2", base, &tmp) == 0)
+        fail();
+
+    mon_lock(m);
+    m->value = 1;
+    while (m->value != 0)
+        mon_wait(m, -1);
+    mon_unlock(m);
+    mon_free(m);
+
+    /* once the version is replaced its base goes away */
+    store("tx_target2", gen_tuples(0, 100));
+    vol_sync();
+    if (delta("tx_target2", base, &tmp) != 0)
+        fail();
+}
+
 static void test_select()
 {
     int a, b, c;
@@ -304,6 +492,142 @@ static void test_join()
         fail();
 }
 
+static void test_pipeline()
+{
+    Rel *l = load("join_1_r1"), *r = load("join_1_r2");
+    Rel *sel = rel_select(rel_join(l, r), expr_true());
+    Vars *wvars = vars_new(0);
+
+    long long sid = tx_enter("", rvars, wvars);
+    load_vars();
+
+    rel_open(sel, vars, &arg);
+
+    Tuple *t;
+    int i = 0;
+    while ((t = rel_next(sel)) != NULL) {
+        tuple_free(t);
+        i++;
+    }
+
+    /* only the hashed side of the join is materialized */
+    if (i != 4 || sel->body != NULL || l->body != NULL || r->body == NULL)
+        fail();
+    if (rel_next(sel) != NULL)
+        fail();
+
+    /* evaluated again, the previous body is dropped */
+    rel_eval(sel, vars, &arg);
+    rel_eval(sel, vars, &arg);
+    if (sel->body == NULL || sel->body->len != 4)
+        fail();
+
+    rel_reset(sel);
+    rel_free(sel);
+    free_vars();
+
+    tx_commit(sid);
+
+    vars_free(wvars);
+}
+
+/* the same relation built twice, the second one optimized */
+static void check_optimize(Rel *(*build)())
+{
+    Rel *l = build(), *r = rel_optimize(build());
+    Vars *wvars = vars_new(0);
+
+    long long sid = tx_enter("", rvars, wvars);
+    load_vars();
+
+    rel_eval(l, vars, &arg);
+    rel_eval(r, vars, &arg);
+    if (l->body->len == 0 || !head_eq(l->head, r->head) || !rel_eq(l, r))
+        fail();
+
+    rel_free(l);
+    rel_free(r);
+    free_vars();
+
+    tx_commit(sid);
+
+    vars_free(wvars);
+}
+
+static Expr *attr(Rel *r, char *name)
+{
+    int pos;
+    Type t;
+    if (!head_attr(r->head, name, &pos, &t))
+        fail();
+
+    return expr_attr(pos, t);
+}
+
+static Rel *opt_select()
+{
+    Rel *r = rel_join(load("join_1_r1"), load("join_1_r2"));
+    r = rel_select(r, expr_gt(attr(r, "r2_id"), expr_int(10)));
+    r = rel_select(r, expr_and(expr_lt(attr(r, "id"), expr_int(3)),
+                               expr_lt(attr(r, "real_val"),
+                                       attr(r, "r2_real_val"))));
+    return rel_select(r, expr_eq(attr(r, "string_val"),
+                                 expr_str("hello_from_r1")));
+}
+
+static Rel *opt_project()
+{
+    char *names[] = {"r2_id", "string_val"};
+    char *from[] = {"int_val"}, *to[] = {"x"};
+
+    Rel *r = rel_rename(load("join_1_r1"), from, to, 1);
+    r = rel_join(r, load("join_1_r2"));
+    r = rel_select(r, expr_gte(attr(r, "x"), expr_int(1)));
+
+    return rel_project(r, names, 2);
+}
+
+static Rel *extend_r1()
+{
+    char *names[] = {"y"};
+    Rel *r = load("join_1_r1");
+    Expr *e[] = {expr_mul(attr(r, "int_val"), expr_int(2))};
+
+    return rel_extend(r, names, e, 1);
+}
+
+static Rel *opt_extend()
+{
+    Rel *r = rel_union(extend_r1(), rel_diff(extend_r1(), extend_r1()));
+
+    return rel_select(r, expr_and(expr_lt(attr(r, "int_val"), expr_int(7)),
+                                  expr_gt(attr(r, "y"), expr_int(2))));
+}
+
+static Rel *opt_join()
+{
+    Rel *r = rel_join(load("one_r1"), load("join_1_r2"));
+    r = rel_join(r, rel_select(load("join_1_r1"), expr_int(1)));
+
+    return rel_join(r, load("one_r1_cpy"));
+}
+
+static Rel *opt_lookup()
+{
+    Rel *r = rel_join(load_indexed("join_1_r1"), load("join_1_r2"));
+    return rel_select(r, expr_and(expr_gt(attr(r, "r2_id"), expr_int(0)),
+                                  expr_eq(expr_int(1), attr(r, "id"))));
+}
+
+static void test_optimize()
+{
+    check_optimize(opt_select);
+    check_optimize(opt_project);
+    check_optimize(opt_extend);
+    check_optimize(opt_join);
+    check_optimize(opt_lookup);
+}
+
 static void test_project()
 {
     char *names[] = {"b", "c"};
@@ -315,6 +639,194 @@ static void test_project()
     prj = rel_project(load("project_2"), names, 2);
     if (!equal(prj, "project_2_res"))
         fail();
+
+    /* duplicates of an unsorted stream */
+    char *deps[] = {"dep_name"};
+    Rel *sel = rel_select(load("summary_emp"), expr_true());
+    prj = rel_project(sel, deps, 1);
+
+    Vars *wvars = vars_new(0);
+    long long sid = tx_enter("", rvars, wvars);
+    load_vars();
+
+    rel_eval(prj, vars, &arg);
+
+    Tuple *t;
+    int it = 0, hr = 0;
+    while ((t = tbuf_next(prj->body)) != NULL) {
+        char *dep = val_str(tuple_attr(t, 0));
+        it += str_cmp(dep, "IT") == 0;
+        hr += str_cmp(dep, "HR") == 0;
+        tuple_free(t);
+    }
+
+    /* the input is not materialized */
+    if (prj->body->len != 2 || it != 1 || hr != 1 || sel->body != NULL)
+        fail();
+
+    rel_free(prj);
+    free_vars();
+
+    tx_commit(sid);
+
+    vars_free(wvars);
+}
+
+static void test_order()
+{
+    char *names[] = {"id", "int_val"};
+    char *from[] = {"id"}, *to[] = {"a"};
+
+    /* the sorted result of a projection keeps its order through streams */
+    Rel *r = rel_project(load("join_1_r1"), names, 2);
+    r = rel_rename(rel_select(r, expr_true()), from, to, 1);
+
+    Vars *wvars = vars_new(0);
+    long long sid = tx_enter("", rvars, wvars);
+    load_vars();
+
+    rel_eval(r, vars, &arg);
+    int pos[] = {0, 1};
+    if (r->body->len == 0 || !index_sorted(r->body, pos, 2))
+        fail();
+
+    tbuf_clean(r->body);
+    rel_free(r);
+    free_vars();
+
+    tx_commit(sid);
+
+    vars_free(wvars);
+}
+
+static void test_index()
+{
+    Rel *r = load_indexed("join_1_r1");
+    r = rel_optimize(rel_select(r, expr_eq(attr(r, "id"), expr_int(2))));
+
+    Vars *wvars = vars_new(0);
+    long long sid = tx_enter("", rvars, wvars);
+
+    /* the variable is not read, so the tuples come through the index */
+    int idx = array_scan(rvars->names, rvars->len, "join_1_r1");
+    Vars *v = vars_new(1);
+    vars_add(v, "join_1_r1", rvars->vers[idx], NULL);
+    str_cpy(v->vols[0], rvars->vols[idx]);
+
+    rel_eval(r, v, &arg);
+    if (v->vals[0] != NULL || r->body->len != 1)
+        fail();
+
+    int id = 2, last = 4, int_val = 1, pos;
+    Type t;
+    head_attr(r->head, "int_val", &pos, &t);
+    if (val_int(tuple_attr(r->body->buf[0], pos)) != int_val)
+        fail();
+
+    /* only the declared attributes are indexed */
+    head_attr(r->head, "id", &pos, &t);
+    Value lo = val_new_int(&id), hi = val_new_int(&last);
+    TBuf *found = vol_index("join_1_r1", rvars->vers[idx], pos, Int, &lo, &hi);
+    if (found == NULL || found->len != 3)
+        fail();
+    for (int i = 0; i < found->len; ++i)
+        if (val_int(tuple_attr(found->buf[i], pos)) != id + i)
+            fail();
+    tbuf_clean(found);
+    tbuf_free(found);
+
+    /* a range may be open on either side */
+    found = vol_index("join_1_r1", rvars->vers[idx], pos, Int, NULL, &lo);
+    if (found == NULL || found->len != 2)
+        fail();
+    tbuf_clean(found);
+    tbuf_free(found);
+
+    found = vol_index("join_1_r1", rvars->vers[idx], pos, Int, &hi, NULL);
+    if (found == NULL || found->len != 2)
+        fail();
+    tbuf_clean(found);
+    tbuf_free(found);
+
+    head_attr(r->head, "int_val", &pos, &t);
+    Value key = val_new_int(&int_val);
+    if (vol_index("join_1_r1", rvars->vers[idx], pos, Int, &key, &key) != NULL)
+        fail();
+
+    tbuf_clean(r->body);
+    rel_free(r);
+
+    /* comparisons become range lookups */
+    r = load_indexed("join_1_r1");
+    Expr *e = expr_and(expr_gt(attr(r, "id"), expr_int(2)),
+                       expr_gte(expr_int(4), attr(r, "id")));
+    r = rel_optimize(rel_select(r, e));
+
+    rel_eval(r, v, &arg);
+    if (v->vals[0] != NULL || r->body->len != 2)
+        fail();
+
+    tbuf_clean(r->body);
+    rel_free(r);
+    vars_free(v);
+
+    tx_commit(sid);
+
+    vars_free(wvars);
+}
+
+static void test_zones()
+{
+    Rel *r = load("join_1_r1");
+    r = rel_optimize(rel_select(r, expr_eq(attr(r, "int_val"), expr_int(2))));
+
+    Vars *wvars = vars_new(0);
+    long long sid = tx_enter("", rvars, wvars);
+
+    /* without an index the blocks are picked through the zone map */
+    int idx = array_scan(rvars->names, rvars->len, "join_1_r1");
+    Vars *v = vars_new(1);
+    vars_add(v, "join_1_r1", rvars->vers[idx], NULL);
+    str_cpy(v->vols[0], rvars->vols[idx]);
+
+    rel_eval(r, v, &arg);
+    if (v->vals[0] != NULL || r->body->len != 2)
+        fail();
+
+    /* ranges go by the value of numbers */
+    int lo = -1, hi = 256, pos;
+    Value min = val_new_int(&lo), max = val_new_int(&hi);
+    Type t;
+    head_attr(r->head, "int_val", &pos, &t);
+    TBuf *found = vol_scan("join_1_r1", rvars->vers[idx], pos, t, &min, &max);
+    if (found == NULL || found->len != 5)
+        fail();
+    tbuf_clean(found);
+    tbuf_free(found);
+
+    /* the same goes for a select with a comparison */
+    tbuf_clean(r->body);
+    rel_free(r);
+    r = load("join_1_r1");
+    r = rel_optimize(rel_select(r, expr_gte(attr(r, "int_val"), expr_int(6))));
+
+    rel_eval(r, v, &arg);
+    if (v->vals[0] != NULL || r->body->len != 2)
+        fail();
+
+    /* the only block is ruled out */
+    found = vol_scan("join_1_r1", rvars->vers[idx], pos, t, &max, &max);
+    if (found == NULL || found->len != 0)
+        fail();
+    tbuf_free(found);
+
+    tbuf_clean(r->body);
+    rel_free(r);
+    vars_free(v);
+
+    tx_commit(sid);
+
+    vars_free(wvars);
 }
 
 static void test_semidiff()
@@ -328,6 +840,57 @@ static void test_semidiff()
         fail();
 }
 
+/* summarizes the employees per department and checks the number of
+   employees and their total age of each resulting tuple */
+static int sum_deps(Rel *r, Rel *per, int empty)
+{
+    int minus_one = -1, pos, dep, emps, ages;
+    Type t;
+    head_attr(r->head, "age", &pos, &t);
+
+    char *names[] = {"employees", "add_age"};
+    Type types[] = {Int, Int};
+    Sum *sums[] = {sum_cnt(), sum_add(pos, t, val_new_int(&minus_one))};
+
+    Rel *sum = rel_sum(r, per, names, types, sums, 2);
+    head_attr(sum->head, "dep_name", &dep, &t);
+    head_attr(sum->head, "employees", &emps, &t);
+    head_attr(sum->head, "add_age", &ages, &t);
+
+    Vars *wvars = vars_new(0);
+    long long sid = tx_enter("", rvars, wvars);
+    load_vars();
+
+    rel_eval(sum, vars, &arg);
+
+    Tuple *tp;
+    int res = 0;
+    while ((tp = tbuf_next(sum->body)) != NULL) {
+        char *name = val_str(tuple_attr(tp, dep));
+        int e = 0, a = -1;
+        if (!empty && str_cmp(name, "IT") == 0)
+            e = 3, a = 162;
+        else if (!empty && str_cmp(name, "HR") == 0)
+            e = 2, a = 90;
+
+        if (val_int(tuple_attr(tp, emps)) != e ||
+            val_int(tuple_attr(tp, ages)) != a)
+            fail();
+
+        tuple_free(tp);
+        res++;
+    }
+
+    rel_free(sum);
+    free_vars();
+
+    tx_commit(sid);
+
+    vars_free(wvars);
+
+    return res;
+}
+
 static void test_summary()
 {
     int int_zero = 0, int_minus_one = -1;
@@ -386,6 +949,24 @@ static void test_summary()
     sum = rel_sum_unary(r, unary_names, unary_types, unary_sums, 6);
     if (!equal(sum, "summary_res_2"))
         fail();
+
+    /* groups without any tuples have the default values */
+    if (sum_deps(load("summary_emp"), load("summary_dep"), 0) != 3)
+        fail();
+    if (sum_deps(rel_select(load("summary_emp"), expr_false()),
+                 load("summary_dep"), 1) != 3)
+        fail();
+
+    /* tuples sharing the common attributes share the group */
+    char *attrs[] = {"dep_name", "name"}, *from[] = {"name"}, *to[] = {"who"};
+    Rel *per = rel_project(load("summary_emp"), attrs, 2);
+    if (sum_deps(load("summary_emp"), rel_rename(per, from, to, 1), 0) != 5)
+        fail();
+
+    /* nothing to summarize by */
+    if (sum_deps(load("summary_emp"),
+                 rel_select(load("summary_dep"), expr_false()), 0) != 0)
+        fail();
 }
 
 static void test_union()
@@ -549,7 +1130,7 @@ int main()
 
     sys_init(0);
     tx_server(source, "bin/state", &tx_port);
-    vol_init(0, "bin/volume");
+    vid = vol_init(0, "bin/volume");
 
     char *code = sys_load(source);
     env = env_new(source, code);
@@ -570,13 +1151,21 @@ int main()
     test_load();
     test_param();
     test_clone();
+    test_reset();
     test_eq();
     test_store();
+    test_delta();
+    test_compact();
     test_select();
     test_rename();
     test_extend();
     test_join();
+    test_pipeline();
+    test_optimize();
     test_project();
+    test_order();
+    test_index();
+    test_zones();
     test_semidiff();
     test_summary();
     test_union();
@@ -171,6 +171,42 @@ static void test_add(Tuple *tuples[])
     mem_free(s_long);
 }
 
+static void test_batch(Tuple *tuples[])
+{
+    Sum *sums[] = {
+        sum_cnt(),
+        sum_min(1, Real, val_new_real(&res.defd)),
+        sum_max(2, Long, val_new_long(&res.defl)),
+        sum_avg(0, Int, val_new_real(&res.defd)),
+        sum_add(1, Real, val_new_real(&res.defd))
+    };
+
+    for (int i = 0; i < 5; ++i) {
+        Sum *s = sums[i];
+
+        sum_reset(s);
+        for (int j = 0; j < MAX; ++j)
+            sum_update(s, tuples[j]);
+        Value v = sum_value(s);
+
+        /* batches continue where the previous ones stopped */
+        sum_reset(s);
+        sum_batch(s, tuples, 3);
+        sum_batch(s, tuples + 3, MAX - 3);
+        if (!val_eq(v, sum_value(s)))
+            fail();
+
+        sum_reset(s);
+        sum_batch(s, tuples, 0);
+        sum_update(s, tuples[0]);
+        sum_batch(s, tuples + 1, MAX - 1);
+        if (!val_eq(v, sum_value(s)))
+            fail();
+
+        mem_free(s);
+    }
+}
+
 int main()
 {
     res.defi = -1;
@@ -235,6 +271,7 @@ int main()
     test_max(tuples);
     test_avg(tuples);
     test_add(tuples);
+    test_batch(tuples);
 
     for (int i = 0; i < MAX; ++i)
         tuple_free(tuples[i]);
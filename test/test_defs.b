@@ -30,7 +30,7 @@ var param_1 basic_01;
 
 type basic_02 {id int, string_val string, int_val int, real_val real}
 
-var join_1_r1 basic_02;
+var join_1_r1 basic_02 index(id);
 
 var storage_r1 basic_02;
 
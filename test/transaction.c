@@ -35,6 +35,7 @@ static char current_test[30];
 static Mon *gmon;
 static int seq;
 static char *vid;
+static char *state = "bin/state";
 
 static void sem_inc(Mon *m)
 {
@@ -453,13 +454,119 @@ static void test_chain(Action a1)
     test("tx_target3", cnt);
 }
 
+/* returns the number of records of a variable (of all the variables if name
+   is NULL) in the state file, ver is set to the last one */
+static int records(const char *name, long long *ver)
+{
+    char *buf = sys_load(state);
+    char *name_sid[2];
+    int cnt = 0, res = 0;
+
+    char **lines = str_split_big(buf, "\n", &cnt);
+    for (int i = 0; i < cnt; ++i) {
+        if (str_len(lines[i]) == 0)
+            continue;
+        if (str_split(lines[i], ",", name_sid, 2) != 2)
+            fail();
+
+        if (name == NULL || str_cmp(name, name_sid[0]) == 0) {
+            res++;
+            if (ver != NULL)
+                *ver = str_to_sid(name_sid[1]);
+        }
+    }
+    mem_free(lines);
+    mem_free(buf);
+
+    return res;
+}
+
+/* appends an old and the current record of tx_empty to the state file
+   followed by a torn one, as if we crashed while writing it */
+static long long log_prepare()
+{
+    long long ver = 0;
+    if (!sys_exists(state) || records("tx_empty", &ver) == 0)
+        return 0;
+
+    char old[MAX_NAME], cur[MAX_NAME], buf[3 * MAX_NAME];
+    str_from_sid(old, 1);
+    str_from_sid(cur, ver);
+    int len = str_print(buf, "tx_empty,%s\ntx_empty,%s\ntx_torn,00",
+                        old, cur);
+
+    IO *io = sys_open(state, WRITE | APPEND);
+    sys_write(io, buf, len);
+    sys_close(io);
+
+    return ver;
+}
+
+static void test_log_replay(long long ver)
+{
+    long long v = 0;
+    char *buf = sys_load(state);
+    int len = str_len(buf);
+
+    if (ver != 0 && (records("tx_empty", &v) != 1 || v != ver))
+        fail();
+    if (records("tx_torn", NULL) != 0)
+        fail();
+    if (len > 0 && buf[len - 1] != '\n')
+        fail();
+
+    mem_free(buf);
+}
+
+static void test_log_checkpoint()
+{
+    TBuf *body = tbuf_new();
+    Vars *r = vars_new(0), *w = vars_new(1);
+    vars_add(w, "tx_empty", 0, NULL);
+
+    /* every commit appends a record until the state is rewritten */
+    int prev = records(NULL, NULL), cnt = prev, i = 0;
+    long long ver = 0;
+    for (; i < 4096 && cnt >= prev; ++i) {
+        prev = cnt;
+
+        long long sid = tx_enter("", r, w);
+        vol_write(w->vols[0], body, w->names[0], w->vers[0]);
+        ver = w->vers[0];
+        tx_commit(sid);
+
+        cnt = records(NULL, NULL);
+        if (cnt != prev + 1 && cnt >= prev)
+            fail();
+    }
+
+    long long v = 0;
+    if (i == 4096 || records("tx_empty", &v) != 1 || v != ver)
+        fail();
+
+    /* the records are appended to the rewritten state */
+    long long sid = tx_enter("", r, w);
+    vol_write(w->vols[0], body, w->names[0], w->vers[0]);
+    ver = w->vers[0];
+    tx_commit(sid);
+
+    if (records(NULL, NULL) != cnt + 1 ||
+        records("tx_empty", &v) != 2 || v != ver)
+        fail();
+
+    vars_free(r);
+    vars_free(w);
+    tbuf_free(body);
+}
+
 int main(void)
 {
     int tx_port = 0;
     char *source = "test/test_defs.b";
 
     sys_init(0);
-    tx_server(source, "bin/state", &tx_port);
+    long long ver = log_prepare();
+    tx_server(source, state, &tx_port);
     vid = vol_init(0, "bin/volume");
 
     char *code = sys_load(source);
@@ -470,6 +577,7 @@ int main(void)
     gmon->value = 1;
     seq = 1;
 
+    test_log_replay(ver);
     test_basics();
     test_reset();
     test_reads();
@@ -485,6 +593,8 @@ int main(void)
     test_chain(TX_COMMIT);
     test_chain(TX_REVERT);
 
+    test_log_checkpoint();
+
     mon_free(gmon);
 
     env_free(env);
@@ -75,8 +75,9 @@ static void test_encdec()
 
     Tuple *t1 = gen_tuple(1);
 
-    char buf1[MAX_STRING];
-    char buf2[MAX_STRING];
+    /* encoded tuples are aligned */
+    long long buf1[MAX_STRING / sizeof(long long)];
+    long long buf2[MAX_STRING / sizeof(long long)];
 
     int enc_len1 = tuple_enc(t1, buf1);
     int dec_len1;
@@ -89,9 +90,15 @@ static void test_encdec()
     int enc_len2 = tuple_enc(t2, buf2);
     if (dec_len1 != enc_len2)
         fail();
-    if (mem_cmp(buf1 + sizeof(Tuple),
-                buf2 + sizeof(Tuple),
-                enc_len2 - sizeof(Tuple)) != 0)
+    Tuple *m1 = tuple_mapped(buf1, enc_len1), *m2 = tuple_mapped(buf2, enc_len2);
+    if (m1 == NULL || m2 == NULL || m1->size != t1->size)
+        fail();
+    if (mem_cmp((char*) m1 + sizeof(Tuple),
+                (char*) m2 + sizeof(Tuple),
+                m1->size - sizeof(Tuple)) != 0)
+        fail();
+    if (tuple_mapped((char*) buf1 + 1, enc_len1) != NULL ||
+        tuple_mapped(buf1, enc_len1 - 1) != NULL)
         fail();
 
     tuple_free(t1);
@@ -132,6 +139,158 @@ static void test_tbuf()
     tbuf_free(b);
 }
 
+static void test_map(int len)
+{
+    char *path = "bin/tmp_map";
+
+    TBuf *b = tbuf_new();
+    for (int i = 0; i < len; ++i)
+        tbuf_add(b, gen_tuple(i));
+
+    IO *io = sys_open(path, CREATE | TRUNCATE | WRITE);
+    if (tbuf_write(b, io) != len)
+        fail();
+    sys_close(io);
+    tbuf_free(b);
+
+    b = tbuf_map(path);
+    if (b == NULL || b->len != len)
+        fail();
+
+    /* a mapped version is byte-identical to a loaded one */
+    io = sys_open(path, READ);
+    TBuf *l = tbuf_read(io);
+    sys_close(io);
+    if (l == NULL || l->len != len)
+        fail();
+
+    Tuple *t;
+    for (int i = 0; (t = tbuf_next(b)) != NULL; ++i) {
+        Tuple *cpy = tuple_cpy(t), *ref = tuple_ref(t);
+        Tuple *exp = gen_tuple(i), *lt = tbuf_next(l);
+
+        if (t->size != lt->size || t->v.len != lt->v.len ||
+            mem_cmp(t + 1, lt + 1, t->size - sizeof(Tuple)) != 0)
+            fail();
+
+        /* the tuples are used in place, they have to be aligned */
+        if ((unsigned long) t % sizeof(long long) != 0)
+            fail();
+
+        int pos[] = {0, 1};
+        if (tuple_cmp(t, exp, pos, pos, 2) != 0)
+            fail();
+        if (tuple_cmp(cpy, exp, pos, pos, 2) != 0)
+            fail();
+        if (ref == t || tuple_cmp(ref, exp, pos, pos, 2) != 0)
+            fail();
+
+        tuple_free(cpy);
+        tuple_free(ref);
+        tuple_free(exp);
+        tuple_free(lt);
+    }
+
+    tbuf_clean(b);
+    tbuf_free(b);
+    tbuf_free(l);
+    sys_remove(path);
+}
+
+static void test_share(const char *path)
+{
+    int pos[] = {0, 1};
+    TBuf *b = gen_tuples(0, 1000);
+    TBuf *s = tbuf_share(b);
+    if (s->len != b->len)
+        fail();
+
+    /* the shared tuples outlive the original buffer */
+    for (int i = 0; i < b->len; ++i)
+        if (s->buf[i] != b->buf[i])
+            fail();
+
+    Tuple *exp = tuple_cpy(b->buf[0]);
+    tbuf_clean(b);
+    tbuf_free(b);
+    if (tuple_cmp(s->buf[0], exp, pos, pos, 2) != 0)
+        fail();
+
+    IO *io = sys_open(path, CREATE | TRUNCATE | WRITE);
+    tbuf_add(s, exp);
+    if (tbuf_write(s, io) != 1001)
+        fail();
+    sys_close(io);
+    tbuf_free(s);
+
+    /* mapped tuples are copied */
+    b = tbuf_map(path);
+    s = tbuf_share(b);
+    if (b == NULL || s->len != 1001 || s->buf[0] == b->buf[0] ||
+        tuple_cmp(s->buf[0], b->buf[0], pos, pos, 2) != 0)
+        fail();
+
+    tbuf_clean(b);
+    tbuf_free(b);
+    tbuf_clean(s);
+    tbuf_free(s);
+    sys_remove(path);
+}
+
+static void test_format(const char *path)
+{
+    /* an empty stream as written before the format was versioned */
+    int old = 0;
+    IO *io = sys_open(path, CREATE | TRUNCATE | WRITE);
+    sys_write(io, &old, sizeof(old));
+    sys_close(io);
+
+    if (tbuf_map(path) != NULL)
+        fail();
+
+    io = sys_open(path, READ);
+    if (tbuf_read(io) != NULL)
+        fail();
+    sys_close(io);
+
+    sys_remove(path);
+}
+
+static void test_arena()
+{
+    Arena *a = arena_new();
+    Tuple *heap = gen_tuple(-1);
+
+    for (int round = 0; round < 3; ++round) {
+        tuple_arena(a);
+
+        TBuf *b = tbuf_new();
+        for (int i = 0; i < 5000; ++i)
+            tbuf_add(b, tuple_cpy(heap));
+
+        /* heap tuples are still released to the heap */
+        Tuple *t = gen_tuple(round);
+        tuple_arena(NULL);
+        tuple_free(heap);
+        heap = t;
+
+        int pos[] = {0, 1};
+        Tuple *exp = gen_tuple(round - 1);
+        tbuf_reset(b);
+        while ((t = tbuf_next(b)) != NULL)
+            if (tuple_cmp(t, exp, pos, pos, 2) != 0)
+                fail();
+
+        tuple_free(exp);
+        tbuf_clean(b);
+        tbuf_free(b);
+        arena_reset(a);
+    }
+
+    tuple_free(heap);
+    arena_free(a);
+}
+
 static void test_cmp(Value t1_vals[], Value t2_vals[])
 {
     Tuple *t1 = tuple_new(t1_vals, 1);
@@ -171,6 +330,55 @@ static void test_cmp(Value t1_vals[], Value t2_vals[])
     tuple_free(t2);
 }
 
+static void test_stats()
+{
+    Head *h = gen_head();
+
+    TBuf *b = gen_tuples(0, 50);
+    for (int i = 0; i < 10; ++i)
+        tbuf_add(b, gen_tuple(7));
+
+    Stats *s = tbuf_stats(b, h);
+    if (s->len != 60 || s->attrs != 2 || s->size <= 0)
+        fail();
+    if (s->vals[0].min != 0.0 || s->vals[0].max != 49.0)
+        fail();
+    if (s->vals[0].distinct != 50 || s->vals[1].distinct != 50)
+        fail();
+    if (s->sorted != 0)
+        fail();
+    mem_free(s);
+
+    /* the order of the buffer is kept and restored on read */
+    int pos[] = {0, 1};
+    index_sort(b, pos, 2);
+    s = tbuf_stats(b, h);
+    if (s->sorted != 2)
+        fail();
+
+    b->olen = 0;
+    tbuf_sorted(b, s);
+    if (!index_sorted(b, pos, 2))
+        fail();
+
+    mem_free(s);
+    tbuf_clean(b);
+    tbuf_free(b);
+
+    /* above the exact range the number of distinct values is estimated */
+    b = gen_tuples(0, 20000);
+    s = tbuf_stats(b, h);
+    if (s->vals[0].distinct < 14000 || s->vals[0].distinct > 26000)
+        fail();
+    if (s->vals[0].max != 19999.0 || stats_size(s) >= (int) sizeof(Stats))
+        fail();
+
+    mem_free(s);
+    tbuf_clean(b);
+    tbuf_free(b);
+    mem_free(h);
+}
+
 int main(void)
 {
     int v_int1 = 1, v_int2 = 2;
@@ -187,6 +395,12 @@ int main(void)
     test_reord(v1, 2);
     test_encdec();
     test_tbuf();
+    test_map(0);
+    test_map(5000);
+    test_share("bin/tmp_share");
+    test_format("bin/tmp_format");
+    test_arena();
+    test_stats();
     test_cmp(v1, v2);
 
     return 0;
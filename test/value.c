@@ -148,6 +148,42 @@ static void test_cmp()
         fail();
 }
 
+static int key_cmp(Value l, Value r, Type t)
+{
+    char lk[MAX_STRING], rk[MAX_STRING];
+    int lsize = val_key(lk, l, t), rsize = val_key(rk, r, t);
+    int res = mem_cmp(lk, rk, lsize < rsize ? lsize : rsize);
+
+    return res != 0 ? res : lsize - rsize;
+}
+
+static void test_key()
+{
+    int i[] = {-137, -1, 0, 1, 256};
+    for (int k = 1; k < 5; ++k)
+        if (key_cmp(val_new_int(&i[k - 1]), val_new_int(&i[k]), Int) >= 0)
+            fail();
+
+    long long l[] = {-5000000000LL, -1, 0, 1, 5000000000LL};
+    for (int k = 1; k < 5; ++k)
+        if (key_cmp(val_new_long(&l[k - 1]), val_new_long(&l[k]), Long) >= 0)
+            fail();
+
+    double r[] = {-1e10, -2.5, -0.25, 0.0, 0.25, 1.0, 3e8};
+    for (int k = 1; k < 7; ++k)
+        if (key_cmp(val_new_real(&r[k - 1]), val_new_real(&r[k]), Real) >= 0)
+            fail();
+
+    double zero = 0.0, neg_zero = -0.0;
+    if (key_cmp(val_new_real(&zero), val_new_real(&neg_zero), Real) != 0)
+        fail();
+
+    char *s[] = {"", "a", "aa", "ab", "b"};
+    for (int k = 1; k < 5; ++k)
+        if (key_cmp(val_new_str(s[k - 1]), val_new_str(s[k]), String) >= 0)
+            fail();
+}
+
 int main(void)
 {
     test_int();
@@ -156,6 +192,7 @@ int main(void)
     test_encdec();
     test_to_str();
     test_cmp();
+    test_key();
 
     return 0;
 }
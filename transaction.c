@@ -39,6 +39,9 @@ static const int REVERTED = 4;
 
 static const long long MAX_LONG = 0x7FFFFFFFFFFFFFFFLL;
 
+/* number of records appended to the state file before it is rewritten */
+static const int CHECKPOINT = 1024;
+
 static const int T_ENTER = 1;
 static const int R_ENTER = 2;
 static const int T_FINISH = 3;
@@ -64,6 +67,20 @@ typedef struct {
     Mon *mon; /* monitor on which the caller/transaction is blocked if needed */
 } Entry;
 
+/* Table keeps the entries of a variable */
+typedef struct {
+    List *commits; /* committed writes, the latest first */
+    Entry *writer; /* the running write (if any) */
+    List *waiting; /* waiting reads and writes */
+    List *reads; /* running reads */
+} Table;
+
+/* Tx keeps the entries of a running transaction */
+typedef struct {
+    long long sid;
+    List *ents;
+} Tx;
+
 static struct {
     char *buf;
     int len;
@@ -71,26 +88,65 @@ static struct {
 
 static struct {
     char *names[MAX_VARS];
+    Table tabs[MAX_VARS];
     int len;
 } gvars;
 
 static char gstate[MAX_FILE_PATH];
 static char gstate_bak[MAX_FILE_PATH];
+
+/* the state file is a log of "name,sid" records, the last record of a
+   variable wins. records of concurrent commits are written together. */
+static struct {
+    char *buf; /* records not yet written (guarded by gmon) */
+    int len;
+    int size;
+    long long seq; /* number of records ever added (guarded by gmon) */
+
+    long long flushed; /* number of records written (guarded by mon) */
+    int busy; /* a thread is writing the records (guarded by mon) */
+    int records; /* records written since the last checkpoint */
+    IO *io;
+    Mon *mon;
+} glog;
 static IO* gio;
-static List *gents;
+static List *gtxs;
 static List *gvols;
 static Mon *gmon;
 static long long last_sid;
 
+static Table *get_table(const char *name)
+{
+    int idx = array_scan(gvars.names, gvars.len, name);
+    if (idx < 0)
+        sys_die("tx: unknown variable '%s'\n", name);
+
+    return &gvars.tabs[idx];
+}
+
+static List *list_remove(List *list, Entry *e)
+{
+    List *res = list;
+    for (List *it = list; it != NULL; it = it->next)
+        if (it->elem == e) {
+            if (it == list)
+                res = it->next;
+
+            list_del(it);
+            break;
+        }
+
+    return res;
+}
+
 /* determines a version to read */
-static long long get_rsid(List *ents, long long sid, const char *name)
+static long long get_rsid(Table *t, long long sid)
 {
     long long res = -1;
 
-    for (List *it = ents; it != NULL; it = it->next) {
+    for (List *it = t->commits; res < 0 && it != NULL; it = it->next) {
         Entry *e = it->elem;
-        if (e->a_type == WRITE && e->state == COMMITTED
-                && e->sid < sid && e->sid > res && str_cmp(e->name, name) == 0)
+        if (e->sid < sid)
             res = e->sid;
     }
 
@@ -98,51 +154,40 @@ static long long get_rsid(List *ents, long long sid, const char *name)
 }
 
 /* returns true if a given sid of a variable is active (being read) */
-static int is_active(List *ents, const char *name, long long sid)
+static int is_active(Table *t, long long sid)
 {
     int res = 0;
 
-    for (List *it = ents; !res && it != NULL; it = it->next) {
+    for (List *it = t->reads; !res && it != NULL; it = it->next) {
         Entry *e = it->elem;
-        res = (e->state == RUNNABLE && e->a_type == READ
-                && e->version == sid && str_cmp(e->name, name) == 0);
+        res = e->version == sid;
     }
 
     return res;
 }
 
-/* returns true if the entry is
-    * non-active, non-latest committed write
-    * committed read
-    * reverted read or write
-*/
-static int rm_entry(List *head, void *elem, const void *cmp)
+/* removes the committed writes which are neither the latest nor active */
+static void rm_entries(Table *t)
 {
-    Entry *e = elem;
-    int rm = 0;
-    if (e->a_type == WRITE && e->state == COMMITTED) {
-        long long sid = e->sid;
-        char *name = e->name;
+    if (t->commits == NULL)
+        return;
 
-        long long rsid = get_rsid(head, MAX_LONG, name);
+    List *it = t->commits->next;
+    while (it != NULL) {
+        Entry *e = it->elem;
+        List *next = it->next;
 
-        int act = is_active(head, name, sid);
+        if (!is_active(t, e->sid)) {
+            list_del(it);
+            mem_free(e);
+        }
 
-        if (sid < rsid && !act)
-            rm = 1;
-    } else if ((e->a_type == READ && e->state == COMMITTED) ||
-               e->state == REVERTED)
-    {
-        rm = 1;
+        it = next;
     }
-
-    if (rm)
-        mem_free(e);
-
-    return rm;
 }
 
-static Entry *add_entry(long long sid,
+static Entry *add_entry(Tx *tx,
+                        long long sid,
                         const char *name,
                         int a_type,
                         long long version,
@@ -158,33 +203,54 @@ static Entry *add_entry(long long sid,
     e->state = state;
     e->mon = mon_new();
 
-    gents = list_prepend(gents, e);
+    Table *t = get_table(name);
+    if (state == WAITING)
+        t->waiting = list_prepend(t->waiting, e);
+    else if (a_type == READ)
+        t->reads = list_prepend(t->reads, e);
+    else if (state == RUNNABLE)
+        t->writer = e;
+    else
+        t->commits = list_prepend(t->commits, e);
+
+    if (tx != NULL)
+        tx->ents = list_prepend(tx->ents, e);
 
     return e;
 }
 
-static List *list_entries(List *ents, long long sid)
+static Tx *get_tx(long long sid)
 {
-    List *dest = NULL;
-    for (List *it = ents; it != NULL; it = it->next) {
-        Entry *e = it->elem;
-        if (e->sid == sid)
-            dest = list_prepend(dest, e);
+    Tx *res = NULL;
+    for (List *it = gtxs; res == NULL && it != NULL; it = it->next) {
+        Tx *tx = it->elem;
+        if (tx->sid == sid)
+            res = tx;
     }
 
-    return dest;
+    return res;
+}
+
+static int rm_tx(List *head, void *elem, const void *cmp)
+{
+    Tx *tx = elem;
+    if (tx == cmp) {
+        mem_free(tx);
+
+        return 1;
+    }
+
+    return 0;
 }
 
-static Entry *get_min_waiting(List *ents, const char *name, int a_type)
+static Entry *get_min_waiting(Table *t, int a_type)
 {
     long long min_sid = MAX_LONG;
     Entry *res = 0;
 
-    for (List *it = ents; it != NULL; it = it->next) {
+    for (List *it = t->waiting; it != NULL; it = it->next) {
         Entry *e = it->elem;
-        if (e->state == WAITING && e->sid < min_sid
-                && e->a_type == a_type && str_cmp(e->name, name) == 0)
-        {
+        if (e->sid < min_sid && e->a_type == a_type) {
             res = e;
             min_sid = e->sid;
         }
@@ -193,37 +259,21 @@ static Entry *get_min_waiting(List *ents, const char *name, int a_type)
     return res;
 }
 
-static List *list_waiting(List *ents,
-                          long long sid,
-                          const char *name,
-                          int a_type)
+static List *list_waiting(Table *t, long long sid, int a_type)
 {
     List *dest = NULL;
-    for (List *it = ents; it != NULL; it = it->next) {
+    for (List *it = t->waiting; it != NULL; it = it->next) {
         Entry *e = it->elem;
-        if (e->state == WAITING && e->sid <= sid
-                && e->a_type == a_type && str_cmp(e->name, name) == 0)
+        if (e->sid <= sid && e->a_type == a_type)
             dest = list_prepend(dest, e);
     }
 
     return dest;
 }
 
-static long long get_wsid(List *ents, const char *name)
+static long long get_wsid(Table *t)
 {
-    long long res = -1;
-
-    for (List *it = ents; it != NULL; it = it->next) {
-        Entry *e = it->elem;
-        if (e->a_type == WRITE && e->state == RUNNABLE
-                && str_cmp(e->name, name) == 0)
-        {
-            res = e->sid;
-            break;
-        }
-    }
-
-    return res;
+    return t->writer != NULL ? t->writer->sid : -1;
 }
 
 static int rm_volume(List *head, void *elem, const void *cmp)
@@ -263,7 +313,7 @@ static Vol *get_volume(const char *vid)
     return vol;
 }
 
-static void closest_vol(char *vid,
+static Vol *closest_vol(char *vid,
                         const char *addr,
                         const char *name,
                         long long ver)
@@ -284,34 +334,34 @@ static void closest_vol(char *vid,
 
     if (v != NULL)
         str_cpy(vid, v->id);
+
+    return v;
 }
 
+/* the volumes report the statistics of their versions on each sync */
 static void set_vols(Vars *v, const char *addr)
 {
-    for (int i = 0; i < v->len; ++i)
-        closest_vol(v->vols[i], addr, v->names[i], v->vers[i]);
+    for (int i = 0; i < v->len; ++i) {
+        Vol *vol = closest_vol(v->vols[i], addr, v->names[i], v->vers[i]);
+
+        int idx = -1;
+        if (vol != NULL)
+            idx = vars_scan(vol->vars, v->names[i], v->vers[i]);
+        if (idx > -1)
+            vars_stats(v, i, vol->vars->stats[idx]);
+    }
 }
 
-static void current_state(List *ents, long long vers[])
+static void current_state(long long vers[])
 {
-    for (int i = 0; i < gvars.len; ++i)
-        vers[i] = 0;
-
-    for (List *it = ents; it != NULL; it = it->next) {
-        Entry *e = it->elem;
-        if (e->a_type == WRITE && e->state == COMMITTED) {
-            int idx = array_scan(gvars.names, gvars.len, e->name);
-            if (vers[idx] < e->version)
-                vers[idx] = e->version;
-        }
+    for (int i = 0; i < gvars.len; ++i) {
+        List *commits = gvars.tabs[i].commits;
+        vers[i] = commits == NULL ? 0 : ((Entry*) commits->elem)->version;
     }
 }
 
-extern void wstate()
+static void wstate(long long vers[])
 {
-    long long vers[gvars.len];
-    current_state(gents, vers);
-
     char sid[MAX_NAME];
     char *buf = mem_alloc(gvars.len * (MAX_NAME + MAX_NAME));
 
@@ -332,48 +382,134 @@ extern void wstate()
     sys_remove(gstate_bak);
 }
 
+static void log_add(const char *name, long long ver)
+{
+    if (glog.size - glog.len < 2 * MAX_NAME) {
+        glog.size += 64 * MAX_NAME;
+        glog.buf = mem_realloc(glog.buf, glog.size);
+    }
+
+    char sid[MAX_NAME];
+    str_from_sid(sid, ver);
+    glog.len += str_print(glog.buf + glog.len, "%s,%s\n", name, sid);
+    glog.seq++;
+}
+
+/* waits until the first seq records are in the state file. the thread which
+   finds no write in progress writes all the pending records */
+static void log_flush(long long seq)
+{
+    mon_lock(glog.mon);
+    while (glog.flushed < seq) {
+        if (glog.busy) {
+            mon_wait(glog.mon, -1);
+            continue;
+        }
+
+        glog.busy = 1;
+        mon_unlock(glog.mon);
+
+        mon_lock(gmon);
+        char *buf = glog.buf;
+        int len = glog.len;
+        long long last = glog.seq;
+        glog.buf = NULL;
+        glog.len = glog.size = 0;
+
+        int cnt = last - glog.flushed;
+        long long vers[gvars.len];
+        if (glog.records + cnt >= CHECKPOINT)
+            current_state(vers);
+        mon_unlock(gmon);
+
+        if (glog.records + cnt >= CHECKPOINT) {
+            sys_close(glog.io);
+            wstate(vers);
+            glog.io = sys_open(gstate, WRITE | APPEND);
+            glog.records = 0;
+        } else {
+            if (sys_write(glog.io, buf, len) < 0)
+                sys_die("tx: cannot append to the state file %s\n", gstate);
+
+            glog.records += cnt;
+        }
+
+        if (buf != NULL)
+            mem_free(buf);
+
+        mon_lock(glog.mon);
+        glog.flushed = last;
+        glog.busy = 0;
+    }
+
+    /* wake up the next waiting thread (which does the same) */
+    mon_signal(glog.mon);
+    mon_unlock(glog.mon);
+}
+
 static void finish(long long sid, int final_state)
 {
     mon_lock(gmon);
 
+    Tx *tx = get_tx(sid);
+    if (tx == NULL) {
+        mon_unlock(gmon);
+        return;
+    }
+
     List *sig = NULL; /* entries to signal (unlock) */
-    List *it = list_entries(gents, sid);
+    List *it = tx->ents;
     for (; it != NULL; it = list_next(it)) {
         Entry *e = it->elem;
+        Table *t = get_table(e->name);
         int prev_state = e->state;
         e->state = final_state;
 
-        if (e->a_type == WRITE && prev_state == RUNNABLE) {
+        if (prev_state == WAITING)
+            t->waiting = list_remove(t->waiting, e);
+        else if (e->a_type == READ)
+            t->reads = list_remove(t->reads, e);
+        else if (e->a_type == WRITE && prev_state == RUNNABLE) {
             long long rsid = e->version;
+            t->writer = NULL;
             if (final_state == REVERTED)
-                rsid = get_rsid(gents, e->sid, e->name);
+                rsid = get_rsid(t, e->sid);
             else {
+                t->commits = list_prepend(t->commits, e);
+                log_add(e->name, e->version);
+
                 Vol *vol = get_volume(e->wvid);
                 if (vol != NULL)
                     vars_add(vol->vars, e->name, e->version, NULL);
             }
 
-            Entry *we = get_min_waiting(gents, e->name, WRITE);
+            Entry *we = get_min_waiting(t, WRITE);
 
             long long wsid = MAX_LONG;
             if (we != NULL) {
                 wsid = we->sid;
+                t->waiting = list_remove(t->waiting, we);
+                t->writer = we;
                 sig = list_prepend(sig, we);
             }
 
-            List *rents = list_waiting(gents, wsid, e->name, READ);
+            List *rents = list_waiting(t, wsid, READ);
             for (; rents != NULL; rents = list_next(rents)) {
                 Entry *re = rents->elem;
                 re->version = rsid;
+                t->waiting = list_remove(t->waiting, re);
+                t->reads = list_prepend(t->reads, re);
                 sig = list_prepend(sig, re);
             }
         }
 
         mon_free(e->mon);
-    }
+        if (e->a_type == READ || e->state == REVERTED)
+            mem_free(e);
 
-    wstate();
-    gents = list_rm(gents, NULL, rm_entry);
+        rm_entries(t);
+    }
+    gtxs = list_rm(gtxs, tx, rm_tx);
 
     for (; sig != NULL; sig = list_next(sig)) {
         Entry *e = sig->elem;
@@ -383,7 +519,12 @@ static void finish(long long sid, int final_state)
         mon_unlock(e->mon);
     }
 
+    /* N.B. the waiting entries run before the state is written, but they
+       finish only after it (their records follow the ones of this tx) */
+    long long seq = glog.seq;
     mon_unlock(gmon);
+
+    log_flush(seq);
 }
 
 extern void commit(long long sid)
@@ -400,8 +541,24 @@ extern void tx_free()
 {
     mon_lock(gmon);
 
-    for (; gents != NULL; gents = list_next(gents))
-        mem_free(gents->elem);
+    for (int i = 0; i < gvars.len; ++i) {
+        Table *t = &gvars.tabs[i];
+        for (; t->commits != NULL; t->commits = list_next(t->commits))
+            mem_free(t->commits->elem);
+        for (; t->waiting != NULL; t->waiting = list_next(t->waiting))
+            mem_free(t->waiting->elem);
+        for (; t->reads != NULL; t->reads = list_next(t->reads))
+            mem_free(t->reads->elem);
+        if (t->writer != NULL)
+            mem_free(t->writer);
+    }
+
+    for (; gtxs != NULL; gtxs = list_next(gtxs)) {
+        Tx *tx = gtxs->elem;
+        while (tx->ents != NULL)
+            tx->ents = list_next(tx->ents);
+        mem_free(tx);
+    }
 
     for (; gvols != NULL; gvols = list_next(gvols)) {
         Vol *vol = gvols->elem;
@@ -414,6 +571,11 @@ extern void tx_free()
 
     mem_free(gcode.buf);
 
+    if (glog.buf != NULL)
+        mem_free(glog.buf);
+    sys_close(glog.io);
+    mon_free(glog.mon);
+
     mon_unlock(gmon);
     mon_free(gmon);
 }
@@ -421,7 +583,7 @@ extern void tx_free()
 static void tx_init(const char *source, const char *state)
 {
     gmon = mon_new();
-    gents = NULL;
+    gtxs = NULL;
     gvols = NULL;
     gcode.buf = sys_load(source);
     gcode.len = str_len(gcode.buf) + 1;
@@ -442,37 +604,51 @@ static void tx_init(const char *source, const char *state)
 
     long long vers[MAX_VARS];
     char *names[MAX_VARS];
-    char *lines[MAX_VARS];
     char *name_sid[2];
 
+    /* the last line might be incomplete if we crashed while appending */
     char *buf = sys_load(gstate);
-    int len = str_split(buf, "\n", lines, MAX_VARS);
-    if (len < 0)
-        sys_die("number of variables in the state file exceeds %d", MAX_VARS);
+    int cnt = 0, len = 0, blen = str_len(buf);
+    for (; blen > 0 && buf[blen - 1] != '\n'; --blen)
+        buf[blen - 1] = '\0';
 
-    if (str_len(lines[len - 1]) == 0)
-        --len;
+    char **lines = str_split_big(buf, "\n", &cnt);
+    if (str_len(lines[cnt - 1]) == 0)
+        --cnt;
 
-    for (int i = 0; i < len; ++i) {
-        int cnt = str_split(lines[i], ",", name_sid, 2);
-        if (cnt != 2)
+    for (int i = 0; i < cnt; ++i) {
+        if (str_split(lines[i], ",", name_sid, 2) != 2)
             sys_die("bad line %s:%d\n", gstate, i + 1);
 
-        names[i] = str_dup(name_sid[0]);
-        vers[i] = str_to_sid(name_sid[1]);
+        long long sid = str_to_sid(name_sid[1]);
+        int idx = array_scan(names, len, name_sid[0]);
+        if (idx < 0) {
+            if (len == MAX_VARS)
+                sys_die("number of variables in the state file exceeds %d",
+                        MAX_VARS);
+
+            idx = len++;
+            names[idx] = str_dup(name_sid[0]);
+        }
+        vers[idx] = sid;
     }
+    mem_free(lines);
     mem_free(buf);
 
     gvars.len = len;
 
     for (int i = 0; i < gvars.len; ++i) {
         gvars.names[i] = names[i];
+        gvars.tabs[i] = (Table) {NULL, NULL, NULL, NULL};
+    }
+
+    for (int i = 0; i < gvars.len; ++i) {
         long long sid = vers[i];
 
         if (sid > last_sid)
             last_sid = sid;
 
-        Entry *e = add_entry(sid, gvars.names[i], WRITE, sid, COMMITTED);
+        Entry *e = add_entry(NULL, sid, gvars.names[i], WRITE, sid, COMMITTED);
         mon_free(e->mon);
     }
 
@@ -484,13 +660,23 @@ static void tx_init(const char *source, const char *state)
         char *name = env->vars.names[i];
         int idx = array_scan(gvars.names, gvars.len, env->vars.names[i]);
         if (idx < 0) {
+            gvars.tabs[gvars.len] = (Table) {NULL, NULL, NULL, NULL};
             gvars.names[gvars.len++] = str_dup(name);
-            Entry *e = add_entry(1, name, WRITE, 1, COMMITTED);
+            Entry *e = add_entry(NULL, 1, name, WRITE, 1, COMMITTED);
             mon_free(e->mon);
         }
     }
 
-    wstate();
+    current_state(vers);
+    wstate(vers);
+
+    glog.buf = NULL;
+    glog.len = glog.size = 0;
+    glog.seq = glog.flushed = 0;
+    glog.busy = glog.records = 0;
+    glog.io = sys_open(gstate, WRITE | APPEND);
+    glog.mon = mon_new();
+
     mon_unlock(gmon);
 
     env_free(env);
@@ -504,11 +690,11 @@ static Vars *volume_sync(const char *vid, Vars *in)
 
     /* populate out variable with the (WRITE/COMMITED) variables */
     Vars *out = vars_new(0);
-    for (List *it = gents; it != NULL; it = it->next) {
-        Entry *e = it->elem;
-        if (e->a_type == WRITE && e->state == COMMITTED)
+    for (int i = 0; i < gvars.len; ++i)
+        for (List *it = gvars.tabs[i].commits; it != NULL; it = it->next) {
+            Entry *e = it->elem;
             vars_add(out, e->name, e->version, NULL);
-    }
+        }
     set_vols(out, vid);
 
     mon_unlock(gmon);
@@ -544,13 +730,18 @@ extern long long enter(const char *eid, Vars *rvars, Vars *wvars, Mon *m)
     closest_vol(wvid, eid, "", 0);
 
     sid = ++last_sid;
+    Tx *tx = mem_alloc(sizeof(Tx));
+    tx->sid = sid;
+    tx->ents = NULL;
+    gtxs = list_prepend(gtxs, tx);
+
     for (int i = 0; i < wvars->len; ++i) {
         const char *name = wvars->names[i];
         int state = WAITING;
-        if (get_wsid(gents, name) < 0)
+        if (get_wsid(get_table(name)) < 0)
             state = RUNNABLE;
 
-        we[i] = add_entry(sid, name, WRITE, sid, state);
+        we[i] = add_entry(tx, sid, name, WRITE, sid, state);
         str_cpy(we[i]->wvid, wvid);
 
         rw = 1;
@@ -558,18 +749,19 @@ extern long long enter(const char *eid, Vars *rvars, Vars *wvars, Mon *m)
 
     for (int i = 0; i < rvars->len; ++i) {
         const char *name = rvars->names[i];
-        long long rsid = get_rsid(gents, sid, name);
+        Table *t = get_table(name);
+        long long rsid = get_rsid(t, sid);
 
         int state = RUNNABLE;
         if (rw) {
-            long long wsid = get_wsid(gents, name);
+            long long wsid = get_wsid(t);
             if (wsid > -1 && sid > wsid) {
                 rsid = -1;
                 state = WAITING;
             }
         }
 
-        re[i] = add_entry(sid, name, READ, rsid, state);
+        re[i] = add_entry(tx, sid, name, READ, rsid, state);
     }
 
     mon_unlock(gmon);
@@ -837,28 +1029,42 @@ extern Vars *tx_volume_sync(const char *vid, Vars *in)
     return out;
 }
 
+static void print_entry(Entry *e)
+{
+    char *a_type = "READ";
+    if (e->a_type == WRITE)
+        a_type = "WRITE";
+
+    char *state = NULL;
+    if (e->state == COMMITTED) state = "COMMITTED";
+    else if (e->state == REVERTED) state = "REVERTED";
+    else if (e->state == RUNNABLE) state = "RUNNABLE";
+    else if (e->state == WAITING) state = "WAITING";
+    else sys_die("tx: unknown state %d\n", e->state);
+
+    sys_print("%-8d %-32s %-5s %-8d %-9s\n",
+              e->sid, e->name, a_type, e->version, state);
+}
+
+static void print_entries(List *ents)
+{
+    for (List *it = ents; it != NULL; it = it->next)
+        print_entry(it->elem);
+}
+
 extern void tx_state()
 {
     mon_lock(gmon);
 
     sys_print("%-8s %-32s %-5s %-8s %-9s\n",
               "SID", "VARIABLE", "ATYPE", "ASID", "STATE");
-    for (List *it = gents; it != NULL; it = it->next) {
-        Entry *e = it->elem;
-        char *a_type = "READ";
-        if (e->a_type == WRITE)
-            a_type = "WRITE";
-
-        char *state = NULL;
-        if (e->state == COMMITTED) state = "COMMITTED";
-        else if (e->state == REVERTED) state = "REVERTED";
-        else if (e->state == RUNNABLE) state = "RUNNABLE";
-        else if (e->state == WAITING) state = "WAITING";
-        else sys_die("tx: unknown state %d\n", e->state);
-
-        sys_print("%-8d %-32s %-5s %-8d %-9s\n",
-                  e->sid, e->name, a_type, e->version, state);
-
+    for (int i = 0; i < gvars.len; ++i) {
+        Table *t = &gvars.tabs[i];
+        print_entries(t->commits);
+        print_entries(t->waiting);
+        print_entries(t->reads);
+        if (t->writer != NULL)
+            print_entry(t->writer);
     }
 
     sys_print("%-8s %-32s %-8s\n",
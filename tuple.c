@@ -24,6 +24,44 @@ limitations under the License.
 #include "value.h"
 #include "tuple.h"
 
+/* tuples and buffers are taken from the arena while it is set. the header
+   in front of each tuple records where it came from and how many owners
+   share it (tuples are immutable, see tuple_ref). tuples written by
+   tbuf_write keep a header as well, so they are usable in a mapped file. */
+typedef struct {
+    int owner;
+    int refs;
+} Hdr;
+
+static const int HEAP = 0;
+static const int ARENA = 1;
+static const int MAPPED = 2;
+
+/* encoded tuples start at multiples of ALIGN, which suits the pointers in
+   the Tuple struct as well as the sizes and offsets after it */
+#define ALIGN ((int) sizeof(long long))
+
+static Arena *garena = NULL;
+
+static Tuple *alloc(int size)
+{
+    Hdr *h = NULL;
+    if (garena == NULL)
+        h = mem_alloc(sizeof(Hdr) + size);
+    else
+        h = arena_alloc(garena, sizeof(Hdr) + size);
+
+    h->owner = garena != NULL ? ARENA : HEAP;
+    h->refs = 1;
+
+    return (Tuple*) (h + 1);
+}
+
+extern void tuple_arena(Arena *a)
+{
+    garena = a;
+}
+
 static void init(Tuple *t)
 {
     void *mem = t + 1;
@@ -38,7 +76,7 @@ extern Tuple *tuple_new(Value vals[], int len)
         size += vals[i].size;
 
     int total = size + sizeof(Tuple) + 2 * len * sizeof(int);
-    Tuple *res = mem_alloc(total);
+    Tuple *res = alloc(total);
     res->size = total;
     res->v.len = len;
     init(res);
@@ -57,42 +95,95 @@ extern Tuple *tuple_new(Value vals[], int len)
 
 extern void tuple_free(Tuple *t)
 {
-    mem_free(t);
+    Hdr *h = (Hdr*) t - 1;
+    if (h->owner == HEAP && --h->refs == 0)
+        mem_free(h);
+}
+
+extern Tuple *tuple_ref(Tuple *t)
+{
+    /* mapped tuples go away with the mapping */
+    Hdr *h = (Hdr*) t - 1;
+    if (h->owner == MAPPED)
+        return tuple_cpy(t);
+
+    h->refs++;
+
+    return t;
 }
 
 extern Tuple *tuple_cpy(Tuple *t)
 {
-    Tuple *res = mem_alloc(t->size);
+    Tuple *res = alloc(t->size);
     mem_cpy(res, t, t->size);
     init(res);
 
     return res;
 }
 
+extern int tuple_enc_size(Tuple *t)
+{
+    return sizeof(Hdr) + (t->size + ALIGN - 1) / ALIGN * ALIGN;
+}
+
 extern Tuple *tuple_dec(void *mem, int *len)
 {
-    *len = int_dec(mem);
-    Tuple *res = mem_alloc(*len);
-    mem_cpy(res, mem, *len);
+    int size;
+    mem_cpy(&size, (char*) mem + sizeof(Hdr), sizeof(size));
+
+    Tuple *res = alloc(size);
+    mem_cpy(res, (char*) mem + sizeof(Hdr), size);
     init(res);
+    *len = tuple_enc_size(res);
 
     return res;
 }
 
 extern int tuple_enc(Tuple *t, void *buf)
 {
-    mem_cpy(buf, t, t->size);
+    Hdr h = {.owner = MAPPED, .refs = 0};
+    int len = tuple_enc_size(t);
+
+    mem_cpy(buf, &h, sizeof(h));
+    mem_cpy((char*) buf + sizeof(h), t, t->size);
+    mem_set((char*) buf + sizeof(h) + t->size, 0, len - sizeof(h) - t->size);
+
+    return len;
+}
 
-    return t->size;
+extern Tuple *tuple_mapped(void *mem, long long size)
+{
+    Hdr *h = mem;
+    Tuple *t = (Tuple*) (h + 1);
+    if ((unsigned long) mem % ALIGN != 0 ||
+        size < (long long) (sizeof(Hdr) + sizeof(Tuple)) ||
+        h->owner != MAPPED || t->size < (int) sizeof(Tuple) ||
+        t->v.len < 0 || t->v.len > MAX_ATTRS ||
+        size < tuple_enc_size(t))
+        return NULL;
+
+    return t;
 }
 
 extern Value tuple_attr(Tuple *t, int pos)
 {
+    /* the layout is addressed relative to the tuple rather than through
+       t->v.size and t->v.off, so mapped (read-only) tuples work as well */
     void *mem = t;
-    Value res = {.size = t->v.size[pos], .data = mem + t->v.off[pos]};
+    int *size = (int*) (t + 1), *off = size + t->v.len;
+    Value res = {.size = size[pos], .data = mem + off[pos]};
     return res;
 }
 
+extern void tuple_attrs(Tuple *ts[], int len, int pos, void *data[])
+{
+    for (int i = 0; i < len; ++i) {
+        void *mem = ts[i];
+        int *off = (int*) (ts[i] + 1) + ts[i]->v.len;
+        data[i] = mem + off[pos];
+    }
+}
+
 extern Tuple *tuple_reord(Tuple *t, int pos[], int len)
 {
     Value res[len];
@@ -120,11 +211,75 @@ extern int tuple_cmp(Tuple *l, Tuple *r, int lpos[], int rpos[], int len)
     return res;
 }
 
+extern int tuple_key(Tuple *t, int pos[], Type types[], int len, void *dest)
+{
+    unsigned char *p = dest;
+    for (int i = 0; i < len; ++i) {
+        Value v = tuple_attr(t, pos[i]);
+        if (types != NULL) {
+            p += val_key(p, v, types[i]);
+            continue;
+        }
+
+        /* the size goes first (big-endian), the same as in val_cmp */
+        for (int j = 0; j < (int) sizeof(int); ++j)
+            *p++ = (unsigned int) v.size >> (8 * (sizeof(int) - j - 1));
+
+        mem_cpy(p, v.data, v.size);
+        p += v.size;
+    }
+
+    return p - (unsigned char*) dest;
+}
+
+extern int tuple_key_size(Tuple *t, int pos[], int len)
+{
+    int res = 0;
+    for (int i = 0; i < len; ++i)
+        res += sizeof(int) + tuple_attr(t, pos[i]).size;
+
+    return res;
+}
+
+extern unsigned int tuple_hash(Tuple *t, int pos[], int len)
+{
+    unsigned int res = 2166136261U;
+    for (int i = 0; i < len; ++i)
+        res = val_hash(tuple_attr(t, pos[i]), res);
+
+    return res;
+}
+
 extern TBuf *tbuf_new()
 {
-    TBuf *res = mem_alloc(sizeof(TBuf));
+    TBuf *res = NULL;
+    if (garena == NULL)
+        res = mem_alloc(sizeof(TBuf));
+    else
+        res = arena_alloc(garena, sizeof(TBuf));
+
+    res->arena = garena != NULL;
     res->pos = res->len = res->size = 0;
     res->buf = NULL;
+    res->map = NULL;
+    res->map_size = 0;
+    res->olen = 0;
+
+    return res;
+}
+
+extern TBuf *tbuf_share(TBuf *b)
+{
+    TBuf *res = tbuf_new();
+    res->size = b->len;
+    res->buf = mem_alloc(sizeof(Tuple*) * (b->len > 0 ? b->len : 1));
+    for (int i = 0; i < b->len; ++i)
+        res->buf[i] = tuple_ref(b->buf[i]);
+    res->len = b->len;
+
+    res->olen = b->olen;
+    for (int i = 0; i < b->olen; ++i)
+        res->order[i] = b->order[i];
 
     return res;
 }
@@ -138,6 +293,7 @@ extern void tbuf_add(TBuf *b, Tuple *t)
 
     b->buf[b->len] = t;
     b->len++;
+    b->olen = 0;
 }
 
 extern void tbuf_reset(TBuf *b)
@@ -163,7 +319,10 @@ extern void tbuf_free(TBuf *b)
 {
     if (b->buf != NULL)
         mem_free(b->buf);
-    mem_free(b);
+    if (b->map != NULL)
+        sys_munmap(b->map, b->map_size);
+    if (!b->arena)
+        mem_free(b);
 }
 
 extern TBuf *tbuf_read(IO *io)
@@ -171,14 +330,22 @@ extern TBuf *tbuf_read(IO *io)
     TBuf *b = tbuf_new();
     char data_buf[MAX_BLOCK];
 
+    long long format = 0;
+    if (sys_readn(io, &format, sizeof(format)) != sizeof(format) ||
+        format != TBUF_FORMAT)
+        goto failure;
+
     for (;;) {
-        int size = -1;
+        long long size = -1;
         if (sys_readn(io, &size, sizeof(size)) != sizeof(size))
             goto failure;
 
         if (size == 0)
             goto success;
 
+        if (size < 0 || size > MAX_BLOCK)
+            goto failure;
+
         char *p = data_buf;
         if (sys_readn(io, p, size) != size)
             goto failure;
@@ -202,22 +369,70 @@ success:
     return b;
 }
 
+extern TBuf *tbuf_map(const char *path)
+{
+    TBuf *b = tbuf_new();
+    b->map = sys_mmap(path, &b->map_size);
+
+    /* same block format as produced by tbuf_write */
+    char *p = b->map, *end = p + b->map_size;
+    if (end - p < (int) sizeof(long long) || long_dec(p) != TBUF_FORMAT)
+        goto failure;
+
+    p += sizeof(long long);
+    for (;;) {
+        if (end - p < (int) sizeof(long long))
+            goto failure;
+
+        long long size = long_dec(p);
+        p += sizeof(long long);
+
+        if (size == 0)
+            goto success;
+
+        if (size < 0 || end - p < size)
+            goto failure;
+
+        char *block = p + size;
+        while (p < block) {
+            Tuple *t = tuple_mapped(p, block - p);
+            if (t == NULL)
+                goto failure;
+
+            tbuf_add(b, t);
+            p += tuple_enc_size(t);
+        }
+    }
+
+failure:
+    tbuf_free(b);
+    b = NULL;
+
+success:
+    return b;
+}
+
+/* the blocks start with their size (as long long values) which keeps the
+   tuples aligned */
 extern int tbuf_write(TBuf *b, IO *io)
 {
-    char data_buf[MAX_BLOCK];
-    char *p = data_buf;
-    int used = 0, count = 0;
+    long long data_buf[MAX_BLOCK / sizeof(long long)];
+    char *p = (char*) data_buf;
+    long long used = 0;
+    int count = 0;
 
     Tuple *t;
     tbuf_reset(b);
+    if (sys_write(io, &TBUF_FORMAT, sizeof(TBUF_FORMAT)) < 0)
+        goto failure;
     while ((t = tbuf_next(b)) != NULL) {
-        used = p - data_buf;
-        if (MAX_BLOCK - used < t->size) {
+        used = p - (char*) data_buf;
+        if (MAX_BLOCK - used < tuple_enc_size(t)) {
             if (sys_write(io, &used, sizeof(used)) < 0 ||
                 sys_write(io, data_buf, used) < 0)
                 goto failure;
 
-            p = data_buf;
+            p = (char*) data_buf;
         }
 
         p += tuple_enc(t, p);
@@ -225,7 +440,7 @@ extern int tbuf_write(TBuf *b, IO *io)
         count++;
     }
 
-    used = p - data_buf;
+    used = p - (char*) data_buf;
     if (sys_write(io, &used, sizeof(used)) < 0)
         goto failure;
 
@@ -246,3 +461,139 @@ failure:
 
     return -1;
 }
+
+extern void tbuf_offsets(TBuf *b, long long offs[])
+{
+    /* mirrors the format and the blocks produced by tbuf_write */
+    long long block = sizeof(TBUF_FORMAT) + sizeof(long long);
+    int used = 0;
+    for (int i = 0; i < b->len; ++i) {
+        int size = tuple_enc_size(b->buf[i]);
+        if (MAX_BLOCK - used < size) {
+            block += used + sizeof(long long);
+            used = 0;
+        }
+
+        offs[i] = block + used;
+        used += size;
+    }
+}
+
+/* the smallest hash values seen, sorted (k minimum values estimate) */
+#define KMV 64
+
+typedef struct {
+    int len;
+    unsigned int vals[KMV];
+} Kmv;
+
+static unsigned int mix(unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static void kmv_add(Kmv *k, unsigned int h)
+{
+    if (k->len == KMV && h >= k->vals[KMV - 1])
+        return;
+
+    int lo = 0, hi = k->len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (k->vals[mid] < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < k->len && k->vals[lo] == h)
+        return;
+
+    int last = k->len < KMV ? k->len : KMV - 1;
+    for (int i = last; i > lo; --i)
+        k->vals[i] = k->vals[i - 1];
+
+    k->vals[lo] = h;
+    if (k->len < KMV)
+        k->len++;
+}
+
+static long long kmv_count(Kmv *k)
+{
+    if (k->len < KMV)
+        return k->len;
+
+    return (long long) ((KMV - 1) * 4294967296.0 / (k->vals[KMV - 1] + 1.0));
+}
+
+extern Stats *tbuf_stats(TBuf *b, Head *h)
+{
+    Stats *s = mem_alloc(sizeof(Stats));
+    s->len = b->len;
+    s->attrs = h->len;
+
+    Kmv *kmv = mem_alloc(sizeof(Kmv) * h->len);
+    for (int j = 0; j < h->len; ++j) {
+        kmv[j].len = 0;
+        s->vals[j].min = s->vals[j].max = 0.0;
+    }
+
+    long long size = 0;
+    for (int i = 0; i < b->len; ++i) {
+        Tuple *t = b->buf[i];
+        size += t->size;
+
+        for (int j = 0; j < h->len; ++j) {
+            Value v = tuple_attr(t, j);
+            kmv_add(&kmv[j], mix(val_hash(v, 0)));
+
+            double d;
+            if (h->types[j] == Int)
+                d = int_dec(v.data);
+            else if (h->types[j] == Real)
+                d = real_dec(v.data);
+            else if (h->types[j] == Long)
+                d = (double) long_dec(v.data);
+            else
+                continue;
+
+            if (i == 0 || d < s->vals[j].min)
+                s->vals[j].min = d;
+            if (i == 0 || d > s->vals[j].max)
+                s->vals[j].max = d;
+        }
+    }
+
+    s->sorted = 0;
+    while (s->sorted < b->olen && b->order[s->sorted] == s->sorted)
+        s->sorted++;
+
+    s->size = b->len == 0 ? 0 : (int) (size / b->len);
+    for (int j = 0; j < h->len; ++j)
+        s->vals[j].distinct = kmv_count(&kmv[j]);
+
+    mem_free(kmv);
+
+    return s;
+}
+
+extern int stats_size(Stats *s)
+{
+    return sizeof(Stats) - (MAX_ATTRS - s->attrs) * sizeof(s->vals[0]);
+}
+
+extern void tbuf_sorted(TBuf *b, Stats *s)
+{
+    if (s == NULL || s->len != b->len)
+        return;
+
+    b->olen = s->sorted;
+    for (int i = 0; i < s->sorted; ++i)
+        b->order[i] = i;
+}
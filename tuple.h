@@ -32,21 +32,81 @@ extern Tuple *tuple_cpy(Tuple *t);
 extern Tuple *tuple_join(Tuple *l, Tuple *r, int lpos[], int rpos[], int len);
 extern Tuple *tuple_reord(Tuple *t, int pos[], int len);
 extern Value tuple_attr(Tuple *t, int pos);
+/* data of the attribute at pos for each of the len tuples */
+extern void tuple_attrs(Tuple *ts[], int len, int pos, void *data[]);
 extern void tuple_free(Tuple *t);
+extern Tuple *tuple_ref(Tuple *t); /* one more owner (a copy if mapped) */
 extern int tuple_cmp(Tuple *l, Tuple *r, int lpos[], int rpos[], int len);
+extern unsigned int tuple_hash(Tuple *t, int pos[], int len);
+
+/* key of the attributes at positions pos, ordered with mem_cmp by value
+   (see val_key) or, with NULL types, the same way as tuple_cmp. the key
+   takes at most tuple_key_size bytes. */
+extern int tuple_key(Tuple *t, int pos[], Type types[], int len, void *dest);
+extern int tuple_key_size(Tuple *t, int pos[], int len);
+
+/* tbuf_write keeps the tuples aligned and marked as mapped, so they can be
+   used in place. tuple_enc writes a tuple that way and returns
+   tuple_enc_size, the bytes it takes. tuple_mapped returns the one written
+   at mem (NULL unless it is aligned and fits into size bytes). */
+extern int tuple_enc(Tuple *t, void *buf);
+extern int tuple_enc_size(Tuple *t);
+extern Tuple *tuple_mapped(void *mem, long long size);
+
+/* allocate new tuples and buffers from the arena (NULL for the heap) */
+extern void tuple_arena(Arena *a);
 
 typedef struct {
     int pos;
     int len;
     int size;
     Tuple **buf;
+
+    /* non-NULL when the tuples point into a mapped file (see tbuf_map) */
+    void *map;
+    long long map_size;
+
+    int arena; /* allocated from an arena (see tuple_arena) */
+
+    /* the tuples are sorted by the attributes at the first olen positions
+       of order (see index_sort), adding a tuple drops the order */
+    int olen;
+    int order[MAX_ATTRS];
 } TBuf;
 
+/* tbuf_write streams start with TBUF_FORMAT ("BNDT" and the version of the
+   format), tbuf_read and tbuf_map reject the streams of other versions */
+static const long long TBUF_FORMAT = 0x0000000254444E42LL;
+
 extern TBuf *tbuf_new();
 extern TBuf *tbuf_read(IO *io);
+extern TBuf *tbuf_map(const char *path);
 extern int tbuf_write(TBuf *b, IO *io);
+/* file offsets the tuples get when the buffer is written by tbuf_write
+   (see tuple_mapped) */
+extern void tbuf_offsets(TBuf *b, long long offs[]);
 extern Tuple *tbuf_next(TBuf *b);
 extern void tbuf_add(TBuf *b, Tuple *t);
+extern TBuf *tbuf_share(TBuf *b); /* same tuples, owned by both buffers */
 extern void tbuf_reset(TBuf *b);
 extern void tbuf_free(TBuf *b);
 extern void tbuf_clean(TBuf *b);
+
+/* statistics of a stored relation (numeric attributes only have min/max) */
+typedef struct {
+    long long len; /* number of tuples */
+    int size; /* average tuple size in bytes */
+    int attrs;
+    int sorted; /* the tuples are sorted by the first sorted attributes */
+    struct {
+        double min;
+        double max;
+        long long distinct; /* approximate number of distinct values */
+    } vals[MAX_ATTRS];
+} Stats;
+
+extern Stats *tbuf_stats(TBuf *b, Head *h);
+extern int stats_size(Stats *s); /* bytes used by the first s->attrs vals */
+
+/* marks a buffer read from a version as sorted the way its statistics say */
+extern void tbuf_sorted(TBuf *b, Stats *s);
@@ -76,6 +76,62 @@ extern int val_cmp(Value l, Value r)
     return l.size > r.size ? 1 : -1;
 }
 
+/* FNV-1a over the binary representation, consistent with val_cmp */
+extern unsigned int val_hash(Value v, unsigned int seed)
+{
+    unsigned int res = seed;
+    unsigned char *data = v.data;
+    for (int i = 0; i < v.size; ++i) {
+        res ^= data[i];
+        res *= 16777619U;
+    }
+
+    return res;
+}
+
+static int key_enc(unsigned char *dest, unsigned long long u, int size)
+{
+    for (int i = 0; i < size; ++i)
+        dest[i] = u >> (8 * (size - i - 1));
+
+    return size;
+}
+
+extern int val_key(void *dest, Value v, Type t)
+{
+    int res = 0;
+    unsigned long long u = 0;
+    double d = 0.0;
+    switch (t) {
+        case Int:
+            u = (unsigned int) val_int(v) ^ 0x80000000U;
+            res = key_enc(dest, u, sizeof(int));
+            break;
+        case Long:
+            u = (unsigned long long) val_long(v) ^ 0x8000000000000000ULL;
+            res = key_enc(dest, u, sizeof(long long));
+            break;
+        case Real:
+            /* negative numbers have all the bits flipped, positive ones
+               (including -0.0 turned into 0.0) only the sign */
+            d = val_real(v);
+            if (d == 0.0)
+                d = 0.0;
+
+            mem_cpy(&u, &d, sizeof(u));
+            u = (u >> 63) ? ~u : u ^ 0x8000000000000000ULL;
+            res = key_enc(dest, u, sizeof(double));
+            break;
+        case String:
+            /* the terminating zero sorts a prefix first */
+            mem_cpy(dest, v.data, v.size);
+            res = v.size;
+            break;
+    }
+
+    return res;
+}
+
 extern int val_bin_enc(void *mem, Value v)
 {
     unsigned char *dest = mem;
@@ -30,5 +30,11 @@ extern char *val_str(Value v);
 extern long long val_long(Value v);
 extern int val_int(Value v);
 extern int val_cmp(Value l, Value r);
+
+/* order-preserving key of a value: keys of the same type compare with
+   mem_cmp (the shorter string first) like the values they encode, returns
+   the key size (at most v.size) */
+extern int val_key(void *dest, Value v, Type t);
+extern unsigned int val_hash(Value v, unsigned int seed);
 extern int val_bin_enc(void *mem, Value v);
 extern int val_to_str(char *dest, Value v, Type t);
@@ -43,6 +43,7 @@ static void vars_init(Vars *v)
         mem_set(v->vols[i], 0, MAX_ADDR);
         v->vers[i] = 0;
         v->vals[i] = NULL;
+        v->stats[i] = NULL;
     }
 }
 
@@ -55,6 +56,7 @@ extern Vars *vars_new(int len)
     res->vols = mem_alloc(len * (sizeof(void*) + MAX_ADDR));
     res->vers = mem_alloc(len * sizeof(long long));
     res->vals = mem_alloc(len * sizeof(void*));
+    res->stats = mem_alloc(len * sizeof(void*));
 
     vars_init(res);
 
@@ -63,15 +65,36 @@ extern Vars *vars_new(int len)
 
 extern void vars_cpy(Vars *dest, Vars *src)
 {
+    for (int i = 0; i < dest->len; ++i)
+        vars_stats(dest, i, NULL);
+
     dest->len = 0;
     for (int i = 0; i < src->len; ++i) {
         vars_add(dest, src->names[i], src->vers[i], src->vals[i]);
         str_cpy(dest->vols[i], src->vols[i]);
+        vars_stats(dest, i, src->stats[i]);
+    }
+}
+
+extern void vars_stats(Vars *v, int idx, Stats *s)
+{
+    if (v->stats[idx] != NULL)
+        mem_free(v->stats[idx]);
+
+    v->stats[idx] = NULL;
+    if (s != NULL) {
+        v->stats[idx] = mem_alloc(sizeof(Stats));
+        mem_cpy(v->stats[idx], s, stats_size(s));
     }
 }
 
 extern void vars_free(Vars *v)
 {
+    for (int i = 0; i < v->len; ++i)
+        if (v->stats[i] != NULL)
+            mem_free(v->stats[i]);
+
+    mem_free(v->stats);
     mem_free(v->names);
     mem_free(v->vers);
     mem_free(v->vols);
@@ -101,6 +124,24 @@ extern Vars *vars_read(IO *io)
     if (sys_readn(io, vols_p(v), size) != size)
         goto failure;
 
+    /* the number of attributes precedes the statistics (-1 if unknown) */
+    for (int i = 0; i < len; ++i) {
+        Stats s;
+        if (sys_readn(io, &s.attrs, sizeof(s.attrs)) != sizeof(s.attrs) ||
+            s.attrs > MAX_ATTRS)
+            goto failure;
+
+        if (s.attrs < 0)
+            continue;
+
+        size = stats_size(&s);
+        if (sys_readn(io, &s, size) != size ||
+            s.attrs < 0 || s.attrs > MAX_ATTRS)
+            goto failure;
+
+        vars_stats(v, i, &s);
+    }
+
     return v;
 
 failure:
@@ -118,7 +159,18 @@ extern int vars_write(Vars *v, IO *io)
         sys_write(io, vols_p(v), v->len * MAX_ADDR) < 0)
         return -1;
 
-    return sizeof(v->len) + v->len * (MAX_NAME + sizeof(long long) + MAX_ADDR);
+    int res = sizeof(v->len) + v->len * (MAX_NAME + sizeof(long long) + MAX_ADDR);
+    for (int i = 0; i < v->len; ++i) {
+        Stats *s = v->stats[i];
+        int attrs = s == NULL ? -1 : s->attrs;
+        if (sys_write(io, &attrs, sizeof(attrs)) < 0 ||
+            (s != NULL && sys_write(io, s, stats_size(s)) < 0))
+            return -1;
+
+        res += sizeof(attrs) + (s == NULL ? 0 : stats_size(s));
+    }
+
+    return res;
 }
 
 extern void vars_add(Vars *v, const char *var, long long ver, TBuf *val)
@@ -128,12 +180,14 @@ extern void vars_add(Vars *v, const char *var, long long ver, TBuf *val)
         char **vols = v->vols;
         long long *vers = v->vers;
         TBuf **vals = v->vals;
+        Stats **stats = v->stats;
 
         v->size += MAX_VARS;
         v->names = mem_alloc(v->size * (sizeof(void*) + MAX_NAME));
         v->vols = mem_alloc(v->size * (sizeof(void*) + MAX_ADDR));
         v->vers = mem_alloc(v->size * sizeof(long long));
         v->vals = mem_alloc(v->size * sizeof(void*));
+        v->stats = mem_alloc(v->size * sizeof(void*));
 
         vars_init(v);
 
@@ -142,11 +196,13 @@ extern void vars_add(Vars *v, const char *var, long long ver, TBuf *val)
             str_cpy(v->vols[i], vols[i]);
             v->vers[i] = vers[i];
             v->vals[i] = vals[i];
+            v->stats[i] = stats[i];
         }
         mem_free(names);
         mem_free(vers);
         mem_free(vols);
         mem_free(vals);
+        mem_free(stats);
     }
 
     str_cpy(v->names[v->len], var);
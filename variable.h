@@ -22,6 +22,7 @@ typedef struct {
     char **vols;
     long long *vers;
     TBuf **vals;
+    Stats **stats; /* statistics of the versions (NULL if unknown) */
 } Vars;
 
 extern Vars *vars_new(int len);
@@ -31,3 +32,4 @@ extern int vars_scan(Vars *v, const char *var, long long ver);
 extern void vars_add(Vars *v, const char *var, long long ver, TBuf *val);
 extern void vars_free(Vars *v);
 extern void vars_cpy(Vars *dest, Vars *src);
+extern void vars_stats(Vars *v, int idx, Stats *s); /* copies s */
@@ -31,6 +31,8 @@ limitations under the License.
 #include "list.h"
 #include "transaction.h"
 #include "environment.h"
+#include "hash.h"
+#include "index.h"
 
 #include "volume.h"
 
@@ -39,6 +41,30 @@ static char path[MAX_FILE_PATH];
 static const int SUFFIX_LEN = 5;
 static const char *SUFFIX = ".part";
 
+/* statistics of a version are kept next to it (see tbuf_stats), and so
+   are the zone maps of snapshots and the indexes of the variables declared
+   with indexed attributes */
+static const char *STATS = ".stats";
+static const char *ZONES = ".zones";
+static const char *INDEX = ".index";
+
+/* a version is either a snapshot (a plain tbuf_write stream) or a delta
+   which starts with the Delta header followed by the inserted and the deleted
+   tuples (two tbuf_write streams) relative to the base version. either way
+   the tbuf_write streams carry the format version (see TBUF_FORMAT). */
+static const int DELTA = -1;
+static const int MAX_DELTAS = 8;
+
+/* a chain of deltas is compacted into a snapshot once it is MAX_DELTAS
+   deep or its deltas take more than 1/DELTA_SHARE of the snapshot */
+static const int DELTA_SHARE = 4;
+
+typedef struct {
+    int marker;
+    int depth;
+    long long base;
+} Delta;
+
 static const int T_READ = 1;
 static const int R_READ = 2;
 static const int T_WRITE = 3;
@@ -48,6 +74,9 @@ static char gaddr[MAX_ADDR];
 
 struct {
     char names[MAX_VARS][MAX_NAME];
+    Head *heads[MAX_VARS];
+    Head *indexes[MAX_VARS];
+    long long last[MAX_VARS]; /* the newest version written (see write) */
     int len;
 } gvars;
 
@@ -59,6 +88,13 @@ typedef struct {
 /* TODO: remove items for closed but unused connections as well */
 static List *gvols; /* used to keep connections to the volumes alive */
 
+/* the bases of the deltas compacted while in use (see sync_tx) */
+static struct {
+    Vars *vers; /* compacted versions */
+    Vars *bases; /* a base of the version at the same position */
+    Mon *mon; /* one sync at a time */
+} gsync;
+
 static void set_path(char *res, const char *name, long long sid, int part)
 {
     res += str_cpy(res, path);
@@ -70,6 +106,19 @@ static void set_path(char *res, const char *name, long long sid, int part)
         str_cpy(res, SUFFIX);
 }
 
+static void set_meta_path(char *res,
+                          const char *name,
+                          long long sid,
+                          const char *ext,
+                          int part)
+{
+    set_path(res, name, sid, 0);
+    res += str_len(res);
+    res += str_cpy(res, ext);
+    if (part)
+        str_cpy(res, SUFFIX);
+}
+
 static void vol_remove(const char *name)
 {
     char file[MAX_FILE_PATH], *f = file;
@@ -85,6 +134,15 @@ static int is_partial(const char *file)
     return str_cmp(suffix, SUFFIX) == 0 ? 1 : 0;
 }
 
+static int is_meta(const char *file, const char *ext)
+{
+    int len = str_len(file), elen = str_len(ext);
+    if (len < elen)
+        return 0;
+
+    return str_cmp(file + len - elen, ext) == 0 ? 1 : 0;
+}
+
 extern long long parse(const char *file, char *rel)
 {
     int i = 0;
@@ -92,7 +150,9 @@ extern long long parse(const char *file, char *rel)
         ;
 
     long long sid = -1;
-    if (file[i] == '-' && !is_partial(file)) {
+    if (file[i] == '-' && !is_partial(file) && !is_meta(file, STATS) &&
+        !is_meta(file, ZONES) && !is_meta(file, INDEX))
+    {
         mem_cpy(rel, file, i);
         rel[i++] = '\0';
 
@@ -102,28 +162,524 @@ extern long long parse(const char *file, char *rel)
     return sid;
 }
 
-static TBuf *read_file(const char *name, long long ver)
+static int read_delta(IO *io, Delta *d)
+{
+    d->depth = 0;
+    d->base = 0;
+
+    if (sys_readn(io, &d->marker, sizeof(d->marker)) != sizeof(d->marker) ||
+        d->marker != DELTA)
+        return 0;
+
+    if (sys_readn(io, &d->depth, sizeof(d->depth)) != sizeof(d->depth) ||
+        sys_readn(io, &d->base, sizeof(d->base)) != sizeof(d->base))
+        return 0;
+
+    return 1;
+}
+
+static int file_delta(const char *name, long long ver, Delta *d)
+{
+    char file[MAX_FILE_PATH];
+    set_path(file, name, ver, 0);
+
+    IO *io = sys_open(file, READ);
+    int res = read_delta(io, d);
+    sys_close(io);
+
+    return res;
+}
+
+/* the data file of a version is in the current format (see TBUF_FORMAT) */
+static int is_current(const char *file)
+{
+    char buf[sizeof(Delta) + sizeof(TBUF_FORMAT)];
+    IO *io = sys_open(file, READ);
+    int size = sys_readn(io, buf, sizeof(buf));
+    sys_close(io);
+
+    int off = 0;
+    if (size >= (int) sizeof(int) && int_dec(buf) == DELTA)
+        off = sizeof(Delta);
+
+    long long format = 0;
+    if (size - off >= (int) sizeof(format))
+        mem_cpy(&format, buf + off, sizeof(format));
+
+    return format == TBUF_FORMAT;
+}
+
+static void add_alive(TBuf *dest, TBuf *src, Hash *dead, int cpy)
+{
+    Tuple *t;
+    tbuf_reset(src);
+    while ((t = tbuf_next(src)) != NULL)
+        if (dead == NULL || !hash_has(dead, t, dead->pos))
+            tbuf_add(dest, cpy ? tuple_cpy(t) : t);
+        else if (!cpy)
+            tuple_free(t);
+}
+
+static TBuf *load(const char *name, long long ver)
+{
+    char file[MAX_FILE_PATH];
+    set_path(file, name, ver, 0);
+    if (!sys_exists(file))
+        return NULL;
+
+    /* versions are immutable once written, the tuples of a snapshot point
+       straight into the mapped file */
+    Delta d;
+    IO *io = sys_open(file, READ);
+    if (!read_delta(io, &d)) {
+        sys_close(io);
+        return tbuf_map(file);
+    }
+
+    if (d.depth < 1 || d.depth > MAX_DELTAS) {
+        sys_close(io);
+        return NULL;
+    }
+
+    /* walk the chain from the newest delta down to the snapshot, a tuple is
+       alive unless it was deleted by a newer delta */
+    int pos[MAX_ATTRS], len = 0, depth = d.depth;
+    for (int i = 0; i < MAX_ATTRS; ++i)
+        pos[i] = i;
+
+    TBuf *res = tbuf_new(), *dels[depth];
+    Hash *dead = NULL;
+    for (;;) {
+        TBuf *ins = NULL, *del = NULL;
+        if (len < depth && (ins = tbuf_read(io)) != NULL &&
+            (del = tbuf_read(io)) == NULL)
+        {
+            tbuf_clean(ins);
+            tbuf_free(ins);
+            ins = NULL;
+        }
+        sys_close(io);
+
+        if (ins == NULL)
+            goto failure;
+
+        add_alive(res, ins, dead, 0);
+        tbuf_free(ins);
+
+        dels[len++] = del;
+        if (dead == NULL && del->len > 0)
+            dead = hash_new(pos, del->buf[0]->v.len, 0);
+        for (int i = 0; i < del->len; ++i)
+            hash_add(dead, del->buf[i]);
+
+        set_path(file, name, d.base, 0);
+        if (!sys_exists(file))
+            goto failure;
+
+        io = sys_open(file, READ);
+        if (!read_delta(io, &d)) {
+            sys_close(io);
+
+            TBuf *base = tbuf_map(file);
+            if (base == NULL)
+                goto failure;
+
+            add_alive(res, base, dead, 1);
+            tbuf_free(base);
+
+            /* like the snapshots, the readers get the version sorted */
+            index_sort(res, pos, res->len > 0 ? res->buf[0]->v.len : 0);
+            goto exit;
+        }
+    }
+
+failure:
+    tbuf_clean(res);
+    tbuf_free(res);
+    res = NULL;
+
+exit:
+    for (int i = 0; i < len; ++i) {
+        tbuf_clean(dels[i]);
+        tbuf_free(dels[i]);
+    }
+    if (dead != NULL)
+        hash_free(dead);
+
+    return res;
+}
+
+static void send_file(IO *io, const char *name, long long ver)
 {
     char file[MAX_FILE_PATH];
     set_path(file, name, ver, 0);
 
+    Delta d;
+    if (file_delta(name, ver, &d)) {
+        TBuf *buf = load(name, ver);
+        if (buf != NULL) {
+            tbuf_write(buf, io);
+            tbuf_free(buf);
+        }
+
+        return;
+    }
+
+    /* snapshots are already in the tbuf_write format, no need to decode */
+    long long size = 0;
+    char *mem = sys_mmap(file, &size);
+    for (long long off = 0; off < size && !io->stop; off += MAX_BLOCK) {
+        int len = size - off > MAX_BLOCK ? MAX_BLOCK : size - off;
+        sys_write(io, mem + off, len);
+    }
+    sys_munmap(mem, size);
+}
+
+/* the head and the indexed attributes of a variable (NULL if unknown) */
+static Head *var_head(const char *name, Head **index)
+{
+    for (int i = 0; i < gvars.len; ++i)
+        if (str_cmp(gvars.names[i], name) == 0) {
+            if (index != NULL)
+                *index = gvars.indexes[i];
+
+            return gvars.heads[i];
+        }
+
+    if (index != NULL)
+        *index = NULL;
+
+    return NULL;
+}
+
+/* compares the values by their order (see val_key) */
+static int key_cmp(Value l, Value r, Type t)
+{
+    unsigned char lk[l.size], rk[r.size];
+    int lsize = val_key(lk, l, t), rsize = val_key(rk, r, t);
+    int res = mem_cmp(lk, rk, lsize < rsize ? lsize : rsize);
+
+    return res != 0 ? res : lsize - rsize;
+}
+
+/* the zone map of a snapshot lists the blocks written by tbuf_write. each
+   block has its offset and size in the file (as long long values)
+   followed by two tuples (encoded as by tbuf_write) with the smallest and
+   the largest value of every attribute, so the readers can skip the blocks
+   which do not match. only the partial file is written, returns 0 if there
+   is none. */
+static int write_zones(const char *name, long long ver, TBuf *buf)
+{
+    Head *head = var_head(name, NULL);
+    if (head == NULL)
+        return 0;
+
+    char part[MAX_FILE_PATH];
+    set_meta_path(part, name, ver, ZONES, 1);
+
+    long long *offs = mem_alloc(sizeof(long long) * (buf->len + 1));
+    tbuf_offsets(buf, offs);
+
+    IO *fio = sys_open(part, CREATE | WRITE);
+    for (int i = 0, j = 0; i < buf->len; i = j) {
+        int len = buf->buf[i]->v.len;
+        Value min[MAX_ATTRS], max[MAX_ATTRS];
+        for (int k = 0; k < len; ++k)
+            min[k] = max[k] = tuple_attr(buf->buf[i], k);
+
+        /* the tuples of a block are next to each other */
+        long long zone[] = {offs[i], tuple_enc_size(buf->buf[i])};
+        for (j = i + 1; j < buf->len && offs[j] == zone[0] + zone[1]; ++j) {
+            for (int k = 0; k < len; ++k) {
+                Value v = tuple_attr(buf->buf[j], k);
+                if (key_cmp(v, min[k], head->types[k]) < 0)
+                    min[k] = v;
+                if (key_cmp(v, max[k], head->types[k]) > 0)
+                    max[k] = v;
+            }
+            zone[1] += tuple_enc_size(buf->buf[j]);
+        }
+
+        Tuple *lo = tuple_new(min, len), *hi = tuple_new(max, len);
+        int size = tuple_enc_size(lo) + tuple_enc_size(hi);
+        char *enc = mem_alloc(size);
+        tuple_enc(lo, enc);
+        tuple_enc(hi, enc + tuple_enc_size(lo));
+
+        sys_write(fio, zone, sizeof(zone));
+        sys_write(fio, enc, size);
+        mem_free(enc);
+        tuple_free(lo);
+        tuple_free(hi);
+    }
+    sys_close(fio);
+
+    mem_free(offs);
+
+    return 1;
+}
+
+static void write_snapshot(const char *name, long long ver, TBuf *buf)
+{
+    int zones = write_zones(name, ver, buf);
+
+    char part[MAX_FILE_PATH], file[MAX_FILE_PATH];
+    set_path(part, name, ver, 1);
+    set_path(file, name, ver, 0);
+
+    IO *fio = sys_open(part, CREATE | WRITE);
+    tbuf_write(buf, fio);
+    sys_close(fio);
+    sys_move(file, part);
+
+    /* a compacted delta is replaced in place, its zones must not show up
+       before the snapshot does */
+    if (zones) {
+        set_meta_path(part, name, ver, ZONES, 1);
+        set_meta_path(file, name, ver, ZONES, 0);
+        sys_move(file, part);
+    }
+}
+
+static void write_stats(const char *name, long long ver, TBuf *buf)
+{
+    Head *head = var_head(name, NULL);
+    if (head == NULL)
+        return;
+
+    char part[MAX_FILE_PATH], file[MAX_FILE_PATH];
+    set_meta_path(part, name, ver, STATS, 1);
+    set_meta_path(file, name, ver, STATS, 0);
+
+    Stats *s = tbuf_stats(buf, head);
+    IO *fio = sys_open(part, CREATE | WRITE);
+    sys_write(fio, s, stats_size(s));
+    sys_close(fio);
+    sys_move(file, part);
+
+    mem_free(s);
+}
+
+/* the index of a version lists, for each indexed attribute, the file
+   offsets of the tuples ordered by its values. the file starts with the
+   number of tuples, the number of indexed attributes and their positions,
+   all of them stored as long long values. */
+static void write_index(const char *name, long long ver, TBuf *buf)
+{
+    Head *index = NULL, *head = var_head(name, &index);
+    if (index == NULL)
+        return;
+
+    int pos[MAX_ATTRS], ipos[MAX_ATTRS], all[MAX_ATTRS];
+    int cnt = head_common(head, index, pos, ipos);
+    for (int i = 0; i < MAX_ATTRS; ++i)
+        all[i] = i;
+
+    long long hdr[2 + MAX_ATTRS] = {buf->len, cnt};
+    for (int i = 0; i < cnt; ++i)
+        hdr[2 + i] = pos[i];
+
+    long long *offs = mem_alloc(sizeof(long long) * (buf->len + 1));
+    long long *sorted = mem_alloc(sizeof(long long) * (buf->len + 1));
+    tbuf_offsets(buf, offs);
+
+    /* the rows are found back through a hash as the sort moves tuples */
+    Hash *rows = hash_build(buf, all, head->len);
+    TBuf *tmp = tbuf_share(buf);
+
+    char part[MAX_FILE_PATH], file[MAX_FILE_PATH];
+    set_meta_path(part, name, ver, INDEX, 1);
+    set_meta_path(file, name, ver, INDEX, 0);
+
+    IO *fio = sys_open(part, CREATE | WRITE);
+    sys_write(fio, hdr, sizeof(long long) * (2 + cnt));
+    for (int i = 0; i < cnt; ++i) {
+        index_order(tmp, pos + i, head->types + pos[i], 1);
+        for (int j = 0; j < tmp->len; ++j)
+            sorted[j] = offs[hash_find(rows, tmp->buf[j], all)];
+
+        sys_write(fio, sorted, sizeof(long long) * tmp->len);
+    }
+    sys_close(fio);
+    sys_move(file, part);
+
+    hash_free(rows);
+    tbuf_clean(tmp);
+    tbuf_free(tmp);
+    mem_free(sorted);
+    mem_free(offs);
+}
+
+static Stats *read_stats(const char *name, long long ver)
+{
+    char file[MAX_FILE_PATH];
+    set_meta_path(file, name, ver, STATS, 0);
+    if (!sys_exists(file))
+        return NULL;
+
+    Stats *s = mem_alloc(sizeof(Stats));
+    s->attrs = -1;
+
     IO *fio = sys_open(file, READ);
-    TBuf *buf = tbuf_read(fio);
+    int size = sys_readn(fio, s, sizeof(Stats));
     sys_close(fio);
 
-    return buf;
+    if (s->attrs < 0 || s->attrs > MAX_ATTRS || size != stats_size(s)) {
+        mem_free(s);
+        s = NULL;
+    }
+
+    return s;
+}
+
+/* the position of a variable in gvars (-1 if unknown) */
+static int var_pos(const char *name)
+{
+    for (int i = 0; i < gvars.len; ++i)
+        if (str_cmp(gvars.names[i], name) == 0)
+            return i;
+
+    return -1;
+}
+
+static long long find_base(const char *name, long long ver)
+{
+    long long res = 0;
+
+    /* the version written last saves listing the directory, any older
+       version which is still there makes a valid base */
+    char file[MAX_FILE_PATH];
+    int idx = var_pos(name);
+    if (idx > -1 && (res = gvars.last[idx]) > 0 && res < ver) {
+        set_path(file, name, res, 0);
+        if (sys_exists(file))
+            return res;
+    }
+
+    res = 0;
+    int num_files;
+    char **files = sys_list(path, &num_files);
+    for (int i = 0; i < num_files; ++i) {
+        char n[MAX_NAME] = "";
+        long long v = parse(files[i], n);
+        if (v > res && v < ver && str_cmp(n, name) == 0)
+            res = v;
+    }
+    mem_free(files);
+
+    return res;
+}
+
+/* computes the tuples inserted into and deleted from the base version,
+   returns 0 if the change is too big for a delta to pay off. both versions
+   are sorted by all their attributes (see write and load), so they are
+   merged rather than hashed. */
+static int diff(const char *name, long long base, TBuf *buf,
+                TBuf **ins, TBuf **del)
+{
+    TBuf *old = load(name, base);
+    if (old == NULL)
+        return 0;
+
+    int pos[MAX_ATTRS], len = 0;
+    for (int i = 0; i < MAX_ATTRS; ++i)
+        pos[i] = i;
+
+    if (buf->len > 0)
+        len = buf->buf[0]->v.len;
+    else if (old->len > 0)
+        len = old->buf[0]->v.len;
+
+    *ins = tbuf_new();
+    *del = tbuf_new();
+
+    int cnt = 0, sorted = 1, i = 0, j = 0;
+    while ((i < buf->len || j < old->len) && cnt * 2 < buf->len && sorted) {
+        int cmp = -1;
+        if (i == buf->len)
+            cmp = 1;
+        else if (j < old->len)
+            cmp = tuple_cmp(buf->buf[i], old->buf[j], pos, pos, len);
+
+        if (cmp < 0) {
+            tbuf_add(*ins, tuple_ref(buf->buf[i++]));
+            cnt++;
+        } else if (cmp > 0) {
+            tbuf_add(*del, tuple_cpy(old->buf[j++]));
+            cnt++;
+        } else {
+            i++;
+            j++;
+        }
+
+        /* a base out of order cannot be merged, it gets a snapshot */
+        if (j > 0 && j < old->len)
+            sorted = tuple_cmp(old->buf[j - 1], old->buf[j], pos, pos, len) < 0;
+    }
+
+    tbuf_clean(old);
+    tbuf_free(old);
+
+    if (cnt * 2 >= buf->len || !sorted) {
+        tbuf_clean(*ins);
+        tbuf_free(*ins);
+        tbuf_clean(*del);
+        tbuf_free(*del);
+
+        return 0;
+    }
+
+    return 1;
 }
 
+/* N.B. writes are never concurrent with the removal of old versions as
+   sync_tx runs in a transaction writing to all variables */
 static void write(const char *name, long long ver, TBuf *buf)
 {
+    /* versions are sorted by all their attributes (the order is kept in
+       the statistics) so the readers do not have to sort them again */
+    int pos[MAX_ATTRS];
+    for (int i = 0; i < MAX_ATTRS; ++i)
+        pos[i] = i;
+    index_sort(buf, pos, buf->len > 0 ? buf->buf[0]->v.len : 0);
+
+    /* the buffer is consumed by the writes below */
+    write_stats(name, ver, buf);
+    write_index(name, ver, buf);
+
+    Delta b, d = {.marker = DELTA, .depth = 1, .base = find_base(name, ver)};
+    if (d.base > 0 && file_delta(name, d.base, &b))
+        d.depth += b.depth;
+
+    int idx = var_pos(name);
+    if (idx > -1 && gvars.last[idx] < ver)
+        gvars.last[idx] = ver;
+
+    /* indexes point into snapshots, so indexed variables have no deltas */
+    TBuf *ins = NULL, *del = NULL;
+    Head *index = NULL;
+    var_head(name, &index);
+    if (d.base == 0 || d.depth > MAX_DELTAS || index != NULL ||
+        !diff(name, d.base, buf, &ins, &del))
+    {
+        write_snapshot(name, ver, buf);
+        return;
+    }
+
     char part[MAX_FILE_PATH], file[MAX_FILE_PATH];
     set_path(part, name, ver, 1);
     set_path(file, name, ver, 0);
 
     IO *fio = sys_open(part, CREATE | WRITE);
-    tbuf_write(buf, fio);
+    sys_write(fio, &d, sizeof(d));
+    tbuf_write(ins, fio);
+    tbuf_write(del, fio);
     sys_close(fio);
     sys_move(file, part);
+
+    tbuf_clean(buf);
+    tbuf_free(ins);
+    tbuf_free(del);
 }
 
 static int read_var(IO *io, char *name, long long *ver)
@@ -234,6 +790,45 @@ exit:
     return res;
 }
 
+static void compact(const char *name, long long ver)
+{
+    char file[MAX_FILE_PATH];
+    set_path(file, name, ver, 0);
+
+    Delta d;
+    if (!sys_exists(file) || !file_delta(name, ver, &d))
+        return;
+
+    /* the size of the deltas down to the snapshot the chain starts from */
+    int depth = d.depth, len = 0;
+    long long size = 0, bases[MAX_DELTAS];
+    do {
+        if (len == MAX_DELTAS)
+            return;
+
+        size += sys_fsize(file);
+        bases[len++] = d.base;
+        set_path(file, name, d.base, 0);
+        if (!sys_exists(file))
+            return;
+    } while (file_delta(name, d.base, &d));
+
+    if (depth < MAX_DELTAS && size * DELTA_SHARE <= sys_fsize(file))
+        return;
+
+    TBuf *buf = load(name, ver);
+    if (buf != NULL) {
+        write_snapshot(name, ver, buf);
+        tbuf_free(buf);
+
+        /* a read which started before might still walk the chain */
+        for (int i = 0; i < len; ++i) {
+            vars_add(gsync.vers, name, ver, NULL);
+            vars_add(gsync.bases, name, bases[i], NULL);
+        }
+    }
+}
+
 static void copy_file(char *name, long long ver, const char *vid)
 {
     char file[MAX_FILE_PATH];
@@ -269,6 +864,8 @@ static void copy_file(char *name, long long ver, const char *vid)
 */
 static Vars *sync_tx()
 {
+    mon_lock(gsync.mon);
+
     char addr[MAX_ADDR] = "";
     Vars *r = vars_new(0), *w = vars_new(gvars.len);
     for (int i = 0; i < gvars.len; ++i)
@@ -287,19 +884,64 @@ static Vars *sync_tx()
     for (int i = 0; i < num_files; ++i) {
         char name[MAX_NAME] = "";
         long long ver = parse(files[i], name);
-        if (ver > 0)
+        if (ver > 0) {
             vars_add(disk, name, ver, NULL);
+
+            Stats *s = read_stats(name, ver);
+            vars_stats(disk, disk->len - 1, s);
+            if (s != NULL)
+                mem_free(s);
+        }
     }
     mem_free(files);
 
     Vars *tx = tx_volume_sync(gaddr, disk);
 
-    /* remove old versions */
+    /* the versions needed to reconstruct the ones still in use */
     char file[MAX_FILE_PATH];
+    Vars *bases = vars_new(0);
+    for (int i = 0; i < tx->len; ++i) {
+        Delta d = {.base = tx->vers[i]};
+        set_path(file, tx->names[i], d.base, 0);
+        while (sys_exists(file) && file_delta(tx->names[i], d.base, &d)) {
+            vars_add(bases, tx->names[i], d.base, NULL);
+            set_path(file, tx->names[i], d.base, 0);
+        }
+    }
+
+    /* and the ones compacted versions had while they are in use, a read of
+       such a version might have started on the delta */
+    Vars *vers = vars_new(0), *pins = vars_new(0);
+    for (int i = 0; i < gsync.vers->len; ++i)
+        if (vars_scan(tx, gsync.vers->names[i], gsync.vers->vers[i]) > -1) {
+            char *name = gsync.bases->names[i];
+            long long base = gsync.bases->vers[i];
+
+            vars_add(vers, name, gsync.vers->vers[i], NULL);
+            vars_add(pins, name, base, NULL);
+            vars_add(bases, name, base, NULL);
+        }
+    vars_free(gsync.vers);
+    vars_free(gsync.bases);
+    gsync.vers = vers;
+    gsync.bases = pins;
+
+    /* remove old versions */
     for (int i = 0; i < disk->len; ++i)
-        if (vars_scan(tx, disk->names[i], disk->vers[i]) < 0) {
+        if (vars_scan(tx, disk->names[i], disk->vers[i]) < 0 &&
+            vars_scan(bases, disk->names[i], disk->vers[i]) < 0)
+        {
             set_path(file, disk->names[i], disk->vers[i], 0);
             sys_remove(file);
+            set_meta_path(file, disk->names[i], disk->vers[i], STATS, 0);
+            if (sys_exists(file))
+                sys_remove(file);
+            set_meta_path(file, disk->names[i], disk->vers[i], ZONES, 0);
+            if (sys_exists(file))
+                sys_remove(file);
+            set_meta_path(file, disk->names[i], disk->vers[i], INDEX, 0);
+            if (sys_exists(file))
+                sys_remove(file);
         }
 
     /* sync with other volumes */
@@ -308,7 +950,17 @@ static Vars *sync_tx()
 
     tx_revert(sid); /* revert is mandatory as this is an artificial tx */
 
+    /* compact the long delta chains in use (their bases go away with the
+       next sync). this does not need the tx as a compacted version has the
+       same content and replaces the delta atomically */
+    for (int i = 0; i < tx->len; ++i)
+        compact(tx->names[i], tx->vers[i]);
+
+    vars_free(bases);
     vars_free(disk);
+
+    mon_unlock(gsync.mon);
+
     return tx;
 }
 
@@ -328,11 +980,7 @@ static void *vol_thread(void *io)
                 msg = R_READ;
                 op = "R_READ";
 
-                TBuf *buf = read_file(name, ver);
-                if (buf != NULL) {
-                    tbuf_write(buf, cio);
-                    tbuf_free(buf);
-                }
+                send_file(cio, name, ver);
             } else if (msg == T_WRITE) {
                 msg = R_WRITE;
                 op = "R_WRITE";
@@ -366,11 +1014,16 @@ static void *serve(void *sio)
     return NULL;
 }
 
+extern void vol_sync()
+{
+    vars_free(sync_tx());
+}
+
 static void *exec_cleanup(void *arg)
 {
     for (;;) {
         sys_sleep(30);
-        vars_free(sync_tx());
+        vol_sync();
     }
 
     return NULL;
@@ -396,8 +1049,14 @@ static void env_check()
     sys_close(io);
 
     gvars.len = new->vars.len;
-    for (int i = 0; i < new->vars.len; ++i)
+    for (int i = 0; i < new->vars.len; ++i) {
         str_cpy(gvars.names[i], new->vars.names[i]);
+        gvars.heads[i] = head_cpy(new->vars.heads[i]);
+        gvars.indexes[i] = NULL;
+        gvars.last[i] = 0;
+        if (new->vars.indexes[i] != NULL)
+            gvars.indexes[i] = head_cpy(new->vars.indexes[i]);
+    }
 
     env_free(old);
     env_free(new);
@@ -406,7 +1065,7 @@ static void env_check()
     mem_free(new_buf);
 }
 
-extern char *vol_init(int port, const char *p)
+static void set_data(const char *p)
 {
     if (str_len(p) > MAX_FILE_PATH)
         sys_die("volume: path '%s' exceeds the maximum length %d\n",
@@ -415,7 +1074,11 @@ extern char *vol_init(int port, const char *p)
     int plen = str_cpy(path, p) - 1;
     for (; plen > 0 && path[plen] == '/'; --plen)
         path[plen] = '\0';
+}
 
+extern char *vol_init(int port, const char *p)
+{
+    set_data(p);
     env_check();
 
     int standalone = port != 0;
@@ -425,16 +1088,24 @@ extern char *vol_init(int port, const char *p)
 
     sys_log('V', "started data=%s, port=%d\n", path, port);
 
-    /* clean up partial files */
+    /* clean up partial files, the versions written by older releases
+       cannot be read */
     int num_files;
-    char **files = sys_list(path, &num_files);
-    for (int i = 0; i < num_files; ++i)
+    char **files = sys_list(path, &num_files), file[MAX_FILE_PATH];
+    for (int i = 0; i < num_files; ++i) {
+        char name[MAX_NAME];
         if (is_partial(files[i]))
             vol_remove(files[i]);
+        else if (parse(files[i], name) > 0) {
+            str_print(file, "%s/%s", path, files[i]);
+            if (!is_current(file))
+                sys_die("volume: %s is not in the current file format "
+                        "(written by an older version?)\n", file);
+        }
+    }
     mem_free(files);
 
     /* create new empty files */
-    char file[MAX_FILE_PATH];
     for (int i = 0; i < gvars.len; ++i) {
         set_path(file, gvars.names[i], 1L, 0);
         if (!sys_exists(file)) {
@@ -444,7 +1115,11 @@ extern char *vol_init(int port, const char *p)
         }
     }
 
-    vars_free(sync_tx()); /* let the TX know immediately about the content */
+    gsync.vers = vars_new(0);
+    gsync.bases = vars_new(0);
+    gsync.mon = mon_new();
+
+    vol_sync(); /* let the TX know immediately about the content */
 
     sys_thread(exec_cleanup, NULL);
     if (standalone)
@@ -455,16 +1130,197 @@ extern char *vol_init(int port, const char *p)
     return gaddr;
 }
 
+extern void vol_local(const char *p)
+{
+    set_data(p);
+    sys_log('V', "local data=%s\n", path);
+}
+
 extern TBuf *vol_read(const char *vid, const char *var, long long ver)
 {
     TBuf *res = NULL;
-    res = read_net(vid, var, ver);
+    if (path[0] != '\0')
+        res = load(var, ver);
+    if (res == NULL)
+        res = read_net(vid, var, ver);
     if (res == NULL)
         sys_die("volume: read failed %s-%016X'\n", var, ver);
 
     return res;
 }
 
+/* the mapped data file of a version is a delta (see read_delta) */
+static int is_delta(const char *mem, long long size)
+{
+    return size >= (long long) sizeof(int) && int_dec(mem) == DELTA;
+}
+
+/* the tuple at an offset of the data file (as found in the index file), only
+   the tuples a lookup touches are checked */
+static Tuple *idx_tuple(char *mem, long long size, long long off, int pos)
+{
+    Tuple *t = NULL;
+    if (off >= 0 && off < size &&
+        (t = tuple_mapped(mem + off, size - off)) != NULL && pos >= t->v.len)
+        t = NULL;
+
+    return t;
+}
+
+extern TBuf *vol_index(const char *name,
+                       long long ver,
+                       int pos,
+                       Type type,
+                       Value *min,
+                       Value *max)
+{
+    char ifile[MAX_FILE_PATH], dfile[MAX_FILE_PATH];
+    set_meta_path(ifile, name, ver, INDEX, 0);
+    set_path(dfile, name, ver, 0);
+
+    if (path[0] == '\0' || !sys_exists(ifile) || !sys_exists(dfile))
+        return NULL;
+
+    TBuf *res = NULL;
+    long long isize = 0, dsize = 0;
+    long long *idx = sys_mmap(ifile, &isize);
+    char *mem = sys_mmap(dfile, &dsize);
+
+    /* the offsets only apply to snapshots */
+    long long len = 0, cnt = 0, *offs = NULL;
+    if (is_delta(mem, dsize))
+        goto exit;
+
+    if (isize >= (long long) (2 * sizeof(long long))) {
+        len = idx[0];
+        cnt = idx[1];
+    }
+    if (cnt < 0 || cnt > MAX_ATTRS || len < 0 ||
+        isize != (long long) sizeof(long long) * (2 + cnt + cnt * len))
+        goto exit;
+
+    for (int i = 0; i < cnt && offs == NULL; ++i)
+        if (idx[2 + i] == pos)
+            offs = idx + 2 + cnt + i * len;
+
+    if (offs == NULL)
+        goto exit;
+
+    /* the first tuple with the attribute not less than min (if any) */
+    long long lo = 0, hi = min == NULL ? 0 : len;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        Tuple *t = idx_tuple(mem, dsize, offs[mid], pos);
+        if (t == NULL)
+            goto exit;
+
+        if (key_cmp(tuple_attr(t, pos), *min, type) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    res = tbuf_new();
+    for (long long i = lo; i < len; ++i) {
+        Tuple *t = idx_tuple(mem, dsize, offs[i], pos);
+        if (t == NULL)
+            goto failure;
+
+        if (max != NULL && key_cmp(tuple_attr(t, pos), *max, type) > 0)
+            break;
+
+        tbuf_add(res, tuple_cpy(t));
+    }
+    goto exit;
+
+failure:
+    tbuf_clean(res);
+    tbuf_free(res);
+    res = NULL;
+
+exit:
+    sys_munmap(idx, isize);
+    sys_munmap(mem, dsize);
+
+    return res;
+}
+
+extern TBuf *vol_scan(const char *name,
+                      long long ver,
+                      int pos,
+                      Type type,
+                      Value *min,
+                      Value *max)
+{
+    char zfile[MAX_FILE_PATH], dfile[MAX_FILE_PATH];
+    set_meta_path(zfile, name, ver, ZONES, 0);
+    set_path(dfile, name, ver, 0);
+
+    if (path[0] == '\0' || !sys_exists(zfile) || !sys_exists(dfile))
+        return NULL;
+
+    long long zsize = 0, dsize = 0;
+    char *zmem = sys_mmap(zfile, &zsize), *dmem = sys_mmap(dfile, &dsize);
+    char *p = zmem, *end = zmem + zsize;
+
+    /* a delta being compacted, the zones are for the snapshot replacing it */
+    TBuf *res = tbuf_new();
+    if (is_delta(dmem, dsize))
+        goto failure;
+
+    while (end - p > 0) {
+        long long zone[2];
+        if (end - p < (long long) sizeof(zone))
+            goto failure;
+
+        mem_cpy(zone, p, sizeof(zone));
+        p += sizeof(zone);
+
+        Tuple *lo = tuple_mapped(p, end - p), *hi = NULL;
+        if (lo == NULL)
+            goto failure;
+
+        p += tuple_enc_size(lo);
+        if ((hi = tuple_mapped(p, end - p)) == NULL)
+            goto failure;
+
+        p += tuple_enc_size(hi);
+        if (zone[0] < 0 || zone[1] < 0 || zone[0] + zone[1] > dsize ||
+            pos >= lo->v.len || pos >= hi->v.len)
+            goto failure;
+
+        if ((min != NULL && key_cmp(tuple_attr(hi, pos), *min, type) < 0) ||
+            (max != NULL && key_cmp(tuple_attr(lo, pos), *max, type) > 0))
+            continue;
+
+        char *t = dmem + zone[0], *block = t + zone[1];
+        while (t < block) {
+            Tuple *tp = tuple_mapped(t, block - t);
+            if (tp == NULL || pos >= tp->v.len)
+                goto failure;
+
+            Value v = tuple_attr(tp, pos);
+            if ((min == NULL || key_cmp(v, *min, type) >= 0) &&
+                (max == NULL || key_cmp(v, *max, type) <= 0))
+                tbuf_add(res, tuple_cpy(tp));
+
+            t += tuple_enc_size(tp);
+        }
+    }
+    goto exit;
+
+failure:
+    tbuf_clean(res);
+    tbuf_free(res);
+    res = NULL;
+
+exit:
+    sys_munmap(zmem, zsize);
+    sys_munmap(dmem, dsize);
+
+    return res;
+}
+
 extern void vol_write(const char *vid,
                       TBuf *buf,
                       const char *var,
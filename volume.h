@@ -16,7 +16,34 @@ limitations under the License.
 */
 
 extern char *vol_init(int port, const char *p);
+
+/* removes the versions no longer in use and compacts the long delta chains
+   (runs periodically once the volume is started) */
+extern void vol_sync();
+
+/* vol_read maps the versions found in the local data directory p */
+extern void vol_local(const char *p);
+
 extern TBuf *vol_read(const char *vid, const char *name, long long ver);
+
+/* tuples of a local version with the indexed attribute at position pos (of
+   the given type) between min and max (inclusive, ordered as by val_key,
+   a NULL bound leaves that side open), or NULL if there is no such index or the version is not a snapshot */
+extern TBuf *vol_index(const char *name,
+                       long long ver,
+                       int pos,
+                       Type type,
+                       Value *min,
+                       Value *max);
+
+/* the same as vol_index for any attribute, reading only the blocks of the
+   version whose zone map does not rule the range out */
+extern TBuf *vol_scan(const char *name,
+                      long long ver,
+                      int pos,
+                      Type type,
+                      Value *min,
+                      Value *max);
 extern void vol_write(const char *vid,
                       TBuf *buf,
                       const char *name,